@@ -0,0 +1,76 @@
+﻿#include "tchisla-solver.h"
+
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+struct BenchCase {
+  int search_mode;
+  int64_t seed;
+  int search_depth;
+};
+
+// Every case expands a fixed number of generations towards a target that is
+// out of reach, so the measured time only depends on the search loop.
+const BenchCase bench_cases[] = {
+  { 0, 4, 7 }, { 0, 5, 8 }, { 0, 7, 8 },
+  { 1, 2, 7 }, { 1, 3, 6 }, { 1, 4, 6 },
+  { 2, 2, 7 }, { 2, 7, 6 },
+};
+
+// Mode 0 cases that store generations G9 and beyond, each is run with both
+// dedup engines, and with the hash sets presized from the generation forecasts.
+const BenchCase deep_bench_cases[] = {
+  { 0, 1, 12 }, { 0, 2, 10 },
+};
+
+int main() {
+  constexpr int64_t unreachable_target = 999999999989;
+
+  for (int mode = 0; mode <= 2; ++mode) {
+    size_t total_values = 0;
+    auto mode_start = chrono::high_resolution_clock::now();
+    for (const BenchCase& bc : bench_cases) {
+      if (bc.search_mode != mode) continue;
+      TchislaSolver ts(unreachable_target, bc.seed, bc.search_mode);
+      ts.Solve(bc.search_depth);
+      total_values += ts.Status().num_candidates;
+    }
+    auto mode_end = chrono::high_resolution_clock::now();
+    auto duration = chrono::duration_cast<chrono::milliseconds>(mode_end - mode_start).count();
+    cout << "Mode " << mode << ": " << total_values << " values in " << duration << "ms" << endl;
+  }
+
+  // 999999999989 is reachable with deep generations of seed 1.
+  constexpr int64_t deep_unreachable_target = 987654321013;
+  struct Engine {
+    TchislaSolver::DedupEngine engine;
+    bool presize_sets;
+    const char* name;
+  };
+  const Engine engines[] = {
+    { TchislaSolver::kHashSet, false, "Hash set" },
+    { TchislaSolver::kHashSet, true, "Presized hash set" },
+    { TchislaSolver::kSortMerge, false, "Sort-merge" },
+  };
+  for (const auto& engine : engines) {
+    size_t total_values = 0;
+    size_t peak_memory = 0;
+    auto engine_start = chrono::high_resolution_clock::now();
+    for (const BenchCase& bc : deep_bench_cases) {
+      TchislaSolver ts(deep_unreachable_target, bc.seed, bc.search_mode);
+      ts.SetDedupEngine(engine.engine);
+      ts.SetPresizeSets(engine.presize_sets);
+      ts.Solve(bc.search_depth);
+      total_values += ts.Status().num_candidates;
+      peak_memory = max(peak_memory, ts.Status().peak_total_memory);
+    }
+    auto engine_end = chrono::high_resolution_clock::now();
+    auto duration = chrono::duration_cast<chrono::milliseconds>(engine_end - engine_start).count();
+    cout << engine.name << " G9+: " << total_values << " values in " << duration << "ms, peak "
+      << peak_memory / (1024 * 1024) << "MB" << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+﻿#include "calibration.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+using std::endl;
+using std::string;
+using std::vector;
+
+// Every case is timed this many times and its fastest run counts, and a
+// candidate setting has to beat the best one by IMPROVEMENT_MARGIN of time times
+// memory, so that timing noise does not move the limits around.
+constexpr int REPEATS = 2;
+constexpr double IMPROVEMENT_MARGIN = 0.9;
+
+// Calls f(name, field) for every field of config.
+template<class Config, class F>
+static void ForEachField(Config& config, const F& f) {
+  f("value_max_limit", config.value_max_limit);
+  f("value_min_limit", config.value_min_limit);
+  f("power_limit", config.power_limit);
+  f("factorial_limit", config.factorial_limit);
+  f("multi_threads_threshold", config.multi_threads_threshold);
+  f("bitmap_limit", config.bitmap_limit);
+  f("precision", config.precision);
+}
+
+bool LoadProfile(const string& path, TchislaSolver::Config* config, string* error) {
+  std::ifstream file(path);
+  if (!file) {
+    *error = "cannot open " + path;
+    return false;
+  }
+  string line;
+  for (int line_number = 1; std::getline(file, line); ++line_number) {
+    line = line.substr(0, line.find('#'));
+    size_t equals = line.find('=');
+    if (line.find_first_not_of(" \t\r") == string::npos) continue;
+    std::istringstream name_stream(line.substr(0, equals));
+    std::istringstream value_stream(equals == string::npos ? "" : line.substr(equals + 1));
+    string name;
+    name_stream >> name;
+    bool parsed = false;
+    ForEachField(*config, [&](const char* field_name, auto& field) {
+      if (name == field_name) parsed = static_cast<bool>(value_stream >> field);
+    });
+    if (!parsed) {
+      *error = path + ":" + std::to_string(line_number) + ": cannot parse \"" + line + "\"";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SaveProfile(const string& path, const TchislaSolver::Config& config) {
+  std::ofstream file(path);
+  file << "# Written by tchisla-solver --calibrate" << endl;
+  file.precision(17);
+  ForEachField(config, [&](const char* field_name, const auto& field) {
+    file << field_name << " = " << field << endl;
+  });
+  return static_cast<bool>(file);
+}
+
+vector<CalibrationCase> DefaultCalibrationCorpus() {
+  return {
+    { 0, 2016, 1 }, { 0, 2016, 5 }, { 0, 2016, 7 }, { 0, 2017, 3 }, { 0, 2017, 9 },
+    { 0, 1000, 4 }, { 0, 50, 8 }, { 0, 12345, 3 }, { 0, 40320, 5 },
+    { 1, 2016, 8 }, { 1, 27, 6 }, { 1, 1000, 5 },
+    { 2, 27, 6 }, { 2, 50, 8 },
+  };
+}
+
+bool LoadCalibrationCorpus(const string& path, vector<CalibrationCase>* corpus, string* error) {
+  std::ifstream file(path);
+  if (!file) {
+    *error = "cannot open " + path;
+    return false;
+  }
+  corpus->clear();
+  string line;
+  for (int line_number = 1; std::getline(file, line); ++line_number) {
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == string::npos) continue;
+    std::istringstream stream(line);
+    CalibrationCase cc;
+    if (!(stream >> cc.search_mode >> cc.target >> cc.seed) || cc.target <= 0 || cc.seed <= 0 ||
+        cc.search_mode < TchislaSolver::AUTO_SEARCH_MODE || cc.search_mode > 2) {
+      *error = path + ":" + std::to_string(line_number) + ": expected \"search_mode target seed\"";
+      return false;
+    }
+    corpus->push_back(cc);
+  }
+  if (corpus->empty()) {
+    *error = path + " holds no cases";
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+struct CorpusRun {
+  vector<size_t> digits;
+  double seconds = 0;
+  size_t peak_memory = 0;
+
+  double Cost() const { return seconds * static_cast<double>(peak_memory); }
+};
+
+}  // namespace
+
+static CorpusRun RunCorpus(const vector<CalibrationCase>& corpus, const TchislaSolver::Config& config,
+    int repeats) {
+  CorpusRun run;
+  for (const CalibrationCase& cc : corpus) {
+    double fastest = INFINITY;
+    for (int i = 0; i < repeats; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      TchislaSolver ts(config, cc.target, cc.seed, cc.search_mode);
+      bool found = ts.Solve();
+      fastest = std::min(fastest, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      if (i == 0) run.digits.push_back(found ? ts.Generations() : 0);
+      run.peak_memory = std::max(run.peak_memory, ts.Status().peak_total_memory);
+    }
+    run.seconds += fastest;
+  }
+  return run;
+}
+
+TchislaSolver::Config Calibrate(const vector<CalibrationCase>& corpus,
+    const TchislaSolver::Config& config, std::ostream* log) {
+  auto report = [log](const string& setting, const CorpusRun& run, const string& verdict) {
+    if (log == nullptr) return;
+    *log << setting << ": " << static_cast<long>(run.seconds * 1000) << "ms, peak "
+      << run.peak_memory / (1024 * 1024) << "MB, " << verdict << endl;
+  };
+
+  TchislaSolver::Config wide = config;
+  wide.value_max_limit = 1e18;
+  wide.power_limit = 64;
+  wide.factorial_limit = FactorialOperator::TABLE_SIZE - 1;
+  CorpusRun baseline = RunCorpus(corpus, wide, 1);
+  report("baseline", baseline, "reference digits");
+
+  TchislaSolver::Config best = config;
+  CorpusRun best_run = RunCorpus(corpus, best, REPEATS);
+  report("start", best_run, best_run.digits == baseline.digits ? "optimal" : "loses optimal results");
+  if (best_run.digits != baseline.digits) {
+    // Start from the wide limits, anything tighter has to prove itself.
+    best = wide;
+    best_run = RunCorpus(corpus, best, REPEATS);
+  }
+
+  auto tune = [&](const char* name, auto TchislaSolver::Config::*field, const auto& grid) {
+    for (auto value : grid) {
+      if (best.*field == value) continue;
+      TchislaSolver::Config candidate = best;
+      candidate.*field = value;
+      CorpusRun run = RunCorpus(corpus, candidate, REPEATS);
+      std::ostringstream setting;
+      setting << name << " = " << value;
+      if (run.digits != baseline.digits) {
+        report(setting.str(), run, "loses optimal results");
+      } else if (run.Cost() < best_run.Cost() * IMPROVEMENT_MARGIN) {
+        report(setting.str(), run, "best so far");
+        best = candidate;
+        best_run = run;
+      } else {
+        report(setting.str(), run, "no better");
+      }
+    }
+  };
+  tune("multi_threads_threshold", &TchislaSolver::Config::multi_threads_threshold,
+      vector<size_t>{ 1000, 2500, 10000, 40000, 160000 });
+  tune("power_limit", &TchislaSolver::Config::power_limit, vector<int64_t>{ 16, 24, 32, 40, 64 });
+  tune("factorial_limit", &TchislaSolver::Config::factorial_limit, vector<int64_t>{ 12, 15, 18, 20 });
+  tune("value_max_limit", &TchislaSolver::Config::value_max_limit, vector<double>{ 1e10, 1e12, 1e15, 1e18 });
+  tune("bitmap_limit", &TchislaSolver::Config::bitmap_limit,
+      vector<uint64_t>{ 0, uint64_t(1) << 16, uint64_t(1) << 20, uint64_t(1) << 24 });
+  return best;
+}
@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "tchisla-solver.h"
+
+
+// Profiles store a TchislaSolver::Config as "name = value" lines, with the
+// names of its fields. A profile may set any subset of them.
+bool LoadProfile(const std::string& path, TchislaSolver::Config* config, std::string* error);
+bool SaveProfile(const std::string& path, const TchislaSolver::Config& config);
+
+
+struct CalibrationCase {
+  int search_mode;
+  int64_t target;
+  int64_t seed;
+};
+
+// Targets that take from a few to a few hundred milliseconds each.
+std::vector<CalibrationCase> DefaultCalibrationCorpus();
+// Reads "search_mode target seed" lines, # starts a comment.
+bool LoadCalibrationCorpus(const std::string& path, std::vector<CalibrationCase>* corpus, std::string* error);
+
+// Finds the limits that solve corpus fastest and with the least memory. A wide
+// baseline first gives the optimal digit count of every case. Then each limit
+// is tuned in turn over its grid, with the others fixed at the best settings
+// so far. A setting only counts if it keeps every digit count of the baseline,
+// and it only replaces the best one if it lowers time times memory by a margin
+// that timing noise does not reach. Starts from and returns config.
+TchislaSolver::Config Calibrate(const std::vector<CalibrationCase>& corpus,
+    const TchislaSolver::Config& config, std::ostream* log);
@@ -0,0 +1,80 @@
+﻿#include "cold-generation.h"
+
+#include <algorithm>
+#include <cstring>
+
+using std::vector;
+
+static uint64_t DoubleBits(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static double BitsDouble(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+ColdGeneration::ColdGeneration(PartitionedList<const Expr*>& members) {
+  vector<uint64_t> ints;
+  vector<uint64_t> doubles;
+  for (const Expr* member : members) {
+    if (member->IsInt()) ints.push_back(static_cast<uint64_t>(member->GetIntUnsafe()));
+    else doubles.push_back(DoubleBits(member->GetDoubleUnsafe()));
+  }
+  num_ints_ = ints.size();
+  num_doubles_ = doubles.size();
+  Encode(ints);
+  Encode(doubles);
+  bytes_.shrink_to_fit();
+}
+
+// Seven bits of a gap per byte, the high bit marks that more follow.
+void ColdGeneration::Encode(vector<uint64_t>& values) {
+  std::sort(values.begin(), values.end());
+  uint64_t last = 0;
+  for (uint64_t value : values) {
+    uint64_t gap = value - last;
+    last = value;
+    while (gap >= 0x80) {
+      bytes_.push_back(static_cast<uint8_t>(gap | 0x80));
+      gap >>= 7;
+    }
+    bytes_.push_back(static_cast<uint8_t>(gap));
+  }
+}
+
+ColdGeneration::Reader::Reader(const ColdGeneration& generation) : generation_(generation) {
+  block_.reserve(BLOCK_SIZE);
+}
+
+const vector<ValueExpr>* ColdGeneration::Reader::NextBlock() {
+  block_.clear();
+  const uint8_t* bytes = generation_.bytes_.data();
+  size_t end = std::min(num_read_ + BLOCK_SIZE, generation_.size());
+  for (; num_read_ < end; ++num_read_) {
+    // The doubles start over from a gap to 0.
+    if (num_read_ == generation_.num_ints_) last_ = 0;
+    uint64_t gap = 0;
+    for (int shift = 0; ; shift += 7) {
+      uint8_t byte = bytes[offset_++];
+      gap |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) break;
+    }
+    last_ += gap;
+    if (num_read_ < generation_.num_ints_) {
+      block_.emplace_back(Value(static_cast<int64_t>(last_)));
+    } else {
+      block_.emplace_back(Value(BitsDouble(last_)));
+    }
+  }
+  return block_.empty() ? nullptr : &block_;
+}
+
+void ColdGeneration::Reader::Rewind() {
+  offset_ = 0;
+  num_read_ = 0;
+  last_ = 0;
+}
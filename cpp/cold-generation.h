@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "expr.h"
+#include "util.h"
+
+
+// The values of a generation that no longer grows, compressed for a value-only
+// search, which keeps nothing else of its members. Integers and the bit patterns
+// of the other values, which order positive doubles like their values, are
+// sorted and stored as varints of the gaps between them, integers first. Small
+// gaps take a byte or two where a member took a ValueExpr and a pointer before.
+//
+// The members are only read in sequence, a block at a time, by a Reader.
+class ColdGeneration {
+public:
+  // Members decoded at once by a Reader.
+  static constexpr size_t BLOCK_SIZE = 1024;
+
+  // Only reads the values of members.
+  explicit ColdGeneration(PartitionedList<const Expr*>& members);
+
+  ColdGeneration(const ColdGeneration&) = delete;
+  ColdGeneration& operator=(const ColdGeneration&) = delete;
+
+  size_t size() const { return num_ints_ + num_doubles_; }
+  size_t AllocatedBytes() const { return sizeof(*this) + bytes_.capacity(); }
+
+  // Decodes the members of a generation into a buffer of its own, in ascending
+  // order of their values. Readers of the same generation are independent.
+  class Reader {
+  public:
+    explicit Reader(const ColdGeneration& generation);
+
+    // The next block of members, null after the last one. The block is only
+    // valid until the next call.
+    const std::vector<ValueExpr>* NextBlock();
+    // Starts over at the first member.
+    void Rewind();
+
+  private:
+    const ColdGeneration& generation_;
+    size_t offset_ = 0;
+    size_t num_read_ = 0;
+    uint64_t last_ = 0;
+    std::vector<ValueExpr> block_;
+  };
+
+private:
+  size_t num_ints_ = 0;
+  size_t num_doubles_ = 0;
+  std::vector<uint8_t> bytes_;
+
+  void Encode(std::vector<uint64_t>& values);
+};
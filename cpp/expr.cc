@@ -1,35 +1,27 @@
 ﻿#include "expr.h"
 
-#include <array>
 #include <cmath>
 #include <sstream>
 
+#include "operators.h"
+
 using std::abs;
-using std::pow;
 using std::round;
-using std::sqrt;
 using std::stoll;
 
-using std::array;
-using std::index_sequence;
-using std::make_index_sequence;
 using std::string;
 using std::ostringstream;
 
-double Expr::DOUBLE_PRECISION = 1e-7;
-
-template <typename Derived>
-static bool IsInstanceOf(const Expr* ptr) {
-  return dynamic_cast<const Derived*>(ptr) != nullptr;
-}
+// Doubles beyond this are never integers, their rounding would overflow int64_t.
+static constexpr double INTEGER_DOUBLE_LIMIT = 9e18;
 
-Expr::Expr(int64_t value) : is_integer_(true) {
+Value::Value(int64_t value) : is_integer_(true) {
   value_.i = value;
 }
 
-Expr::Expr(double value) {
+Value::Value(double value) {
   double nearby_int = round(value);
-  is_integer_ = abs(value - nearby_int) < DOUBLE_PRECISION;
+  is_integer_ = abs(value - nearby_int) < precision_ && abs(nearby_int) < INTEGER_DOUBLE_LIMIT;
   if (is_integer_) {
     value_.i = static_cast<int64_t>(nearby_int);
   } else {
@@ -37,16 +29,30 @@ Expr::Expr(double value) {
   }
 }
 
-int64_t Expr::GetInt() const {
+int64_t Value::GetInt() const {
   if (is_integer_) return value_.i;
   else return static_cast<int64_t>(value_.d);
 }
 
-double Expr::GetDouble() const {
+double Value::GetDouble() const {
   if (is_integer_) return static_cast<double>(value_.i);
   else return value_.d;
 }
 
+// Without a derivation only the value itself can be rendered.
+string ValueExpr::ToString() const {
+  if (const Expr* expr = Resolve()) return expr->ToString();
+  ostringstream ss;
+  if (IsInt()) ss << GetIntUnsafe();
+  else ss << GetDoubleUnsafe();
+  return ss.str();
+}
+
+Expr::Form ValueExpr::GetForm() const {
+  const Expr* expr = Resolve();
+  return expr != nullptr ? expr->GetForm() : kLiteral;
+}
+
 LiteralExpr::LiteralExpr(string&& literal)
   : Expr(static_cast<int64_t>(stoll(literal))), literal_(literal) {
 }
@@ -55,13 +61,13 @@ string LiteralExpr::ToString() const {
   return literal_;
 }
 
-BinaryExpr::BinaryExpr(char oper, const Expr* left, const Expr* right, double value)
+BinaryExpr::BinaryExpr(char oper, const Expr* left, const Expr* right, const Value& value)
   : Expr(value), oper_(oper), left_(left), right_(right) {
 }
 
 string BinaryExpr::LeftToString() const {
   ostringstream ss;
-  if (IsInstanceOf<BinaryExpr>(left_)) {
+  if (left_->GetForm() == kBinary) {
     ss << '(' << left_->ToString() << ')';
   } else {
     ss << left_->ToString();
@@ -71,7 +77,7 @@ string BinaryExpr::LeftToString() const {
 
 string BinaryExpr::RightToString() const {
   ostringstream ss;
-  if (IsInstanceOf<BinaryExpr>(right_)) {
+  if (right_->GetForm() == kBinary) {
     ss << '(' << right_->ToString() << ')';
   } else {
     ss << right_->ToString();
@@ -86,27 +92,27 @@ string BinaryExpr::ToString() const {
 }
 
 AddExpr::AddExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('+', left, right, left->GetDouble() + right->GetDouble()) {
+  : BinaryExpr('+', left, right, AdditionOperator::Evaluate(*left, *right)) {
 }
 
 SubExpr::SubExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('-', left, right, left->GetDouble() - right->GetDouble()) {
+  : BinaryExpr('-', left, right, SubtractionOperator::Evaluate(*left, *right)) {
 }
 
 MulExpr::MulExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('*', left, right, left->GetDouble() * right->GetDouble()) {
+  : BinaryExpr('*', left, right, MultiplicationOperator::Evaluate(*left, *right)) {
 }
 
 DivExpr::DivExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('/', left, right, left->GetDouble() / right->GetDouble()) {
+  : BinaryExpr('/', left, right, DivisionOperator::Evaluate(*left, *right)) {
 }
 
 PowExpr::PowExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('^', left, right, pow(left->GetDouble(), right->GetDouble())) {
+  : BinaryExpr('^', left, right, PowerOperator::Evaluate(*left, *right)) {
 }
 
 NegPowExpr::NegPowExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('A', left, right, 1.0 / pow(left->GetDouble(), right->GetDouble())) {
+  : BinaryExpr('A', left, right, NegativePowerOperator::Evaluate(*left, *right)) {
 }
 
 string NegPowExpr::ToString() const {
@@ -116,7 +122,7 @@ string NegPowExpr::ToString() const {
 }
 
 MultiSqrtPowExpr::MultiSqrtPowExpr(int sqrt_times, const Expr* left, const Expr* right)
-  : BinaryExpr('^', left, right, pow(left->GetDouble(), right->GetInt() >> sqrt_times)),
+  : BinaryExpr('^', left, right, MultiSqrtPowerOperator<true>::Evaluate(sqrt_times, *left, *right)),
   sqrt_times_(sqrt_times) {
 }
 
@@ -128,7 +134,7 @@ string MultiSqrtPowExpr::LeftToString() const {
 }
 
 NegMultiSqrtPowExpr::NegMultiSqrtPowExpr(int sqrt_times, const Expr* left, const Expr* right)
-  : BinaryExpr('A', left, right, 1.0 / pow(left->GetDouble(), right->GetInt() >> sqrt_times)),
+  : BinaryExpr('A', left, right, MultiSqrtPowerOperator<true>::EvaluateReciprocal(sqrt_times, *left, *right)),
   sqrt_times_(sqrt_times) {
 }
 
@@ -146,7 +152,7 @@ string NegMultiSqrtPowExpr::ToString() const {
 }
 
 SqrtMulExpr::SqrtMulExpr(const Expr* left, const Expr* right)
-  : BinaryExpr('*', left, right, left->GetDouble() * sqrt(right->GetDouble())) { }
+  : BinaryExpr('*', left, right, SqrtMultiplicationOperator::Evaluate(*left, *right)) { }
 
 string SqrtMulExpr::RightToString() const {
   ostringstream ss;
@@ -154,32 +160,13 @@ string SqrtMulExpr::RightToString() const {
   return ss.str();
 }
 
-constexpr static int64_t FactorialRaw(int64_t n) {
-  int64_t res = 1;
-  while (n > 0) res *= n--;
-  return res;
-}
-
-template <class T, size_t... Is>
-constexpr static auto GenerateTable(T(*func)(int64_t), index_sequence<Is...>) {
-  return array<T, sizeof...(Is)>{func(Is)...};
-}
-
 FactorialExpr::FactorialExpr(const Expr* expr)
-  : Expr(Factorial(expr->GetInt())), child_(expr) {
-}
-
-int64_t FactorialExpr::Factorial(int64_t n) {
-  constexpr int table_size = 21;
-  constexpr static auto factorial_table =
-    GenerateTable(FactorialRaw, make_index_sequence<table_size>{});
-  if (n < table_size) return factorial_table[n];
-  else return FactorialRaw(n);
+  : Expr(FactorialOperator::Evaluate(*expr)), child_(expr) {
 }
 
 string FactorialExpr::ToString() const {
   ostringstream ss;
-  if (IsInstanceOf<LiteralExpr>(child_) || IsInstanceOf<FactorialExpr>(child_)) {
+  if (child_->GetForm() == kLiteral || child_->GetForm() == kFactorial) {
     ss << child_->ToString() << '!';
   } else {
     ss << '(' << child_->ToString() << ")!";
@@ -187,13 +174,29 @@ string FactorialExpr::ToString() const {
   return ss.str();
 }
 
+// Rendered with a single double exclamation mark, since n!! is read as (n!)!
+// by the factorial above.
+DoubleFactorialExpr::DoubleFactorialExpr(const Expr* expr)
+  : Expr(DoubleFactorialOperator::Evaluate(*expr)), child_(expr) {
+}
+
+string DoubleFactorialExpr::ToString() const {
+  ostringstream ss;
+  if (child_->GetForm() == kLiteral) {
+    ss << child_->ToString() << "‼";
+  } else {
+    ss << '(' << child_->ToString() << ")‼";
+  }
+  return ss.str();
+}
+
 SqrtExpr::SqrtExpr(const Expr* expr)
-  : Expr(sqrt(expr->GetDouble())), child_(expr) {
+  : Expr(SquareRootOperator<RootPolicy::kAll>::Evaluate(*expr)), child_(expr) {
 }
 
 string SqrtExpr::ToString() const {
   ostringstream ss;
-  if (IsInstanceOf<LiteralExpr>(child_) || IsInstanceOf<FactorialExpr>(child_)) {
+  if (child_->GetForm() == kLiteral || child_->GetForm() == kFactorial) {
     ss << "√" << child_->ToString();
   } else {
     ss << "√(" << child_->ToString() << ')';
@@ -202,12 +205,12 @@ string SqrtExpr::ToString() const {
 }
 
 DoubleSqrtExpr::DoubleSqrtExpr(const Expr* expr)
-  : Expr(sqrt(sqrt(expr->GetDouble()))), child_(expr) {
+  : Expr(DoubleSquareRootOperator<RootPolicy::kAll>::Evaluate(*expr)), child_(expr) {
 }
 
 string DoubleSqrtExpr::ToString() const {
   ostringstream ss;
-  if (IsInstanceOf<LiteralExpr>(child_) || IsInstanceOf<FactorialExpr>(child_)) {
+  if (child_->GetForm() == kLiteral || child_->GetForm() == kFactorial) {
     ss << "√√" << child_->ToString();
   } else {
     ss << "√√(" << child_->ToString() << ')';
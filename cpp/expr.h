@@ -1,13 +1,30 @@
 ﻿#pragma once
 
+#include <cstdint>
 #include <string>
 
-class Expr {
+// A number as the solver compares it, doubles within the precision of an
+// integer are kept as that integer. The precision belongs to the calling
+// thread, so that solvers with different ones can run side by side.
+class Value {
 public:
-  static double DOUBLE_PRECISION;
+  static constexpr double DEFAULT_PRECISION = 1e-7;
 
-  Expr(int64_t value);
-  Expr(double value);
+  // Makes the calling thread use precision until the binding goes out of scope.
+  class PrecisionBinding {
+  public:
+    explicit PrecisionBinding(double precision) : previous_(precision_) { precision_ = precision; }
+    ~PrecisionBinding() { precision_ = previous_; }
+
+    PrecisionBinding(const PrecisionBinding&) = delete;
+    PrecisionBinding& operator=(const PrecisionBinding&) = delete;
+
+  private:
+    double previous_;
+  };
+
+  Value(int64_t value);
+  Value(double value);
 
   int64_t GetInt() const;
   double GetDouble() const;
@@ -16,9 +33,9 @@ public:
   int64_t GetIntUnsafe() const { return value_.i; }
   double GetDoubleUnsafe() const { return value_.d; }
 
-  virtual std::string ToString() const = 0;
-
 private:
+  static inline thread_local double precision_ = DEFAULT_PRECISION;
+
   bool is_integer_;
 
   union {
@@ -28,11 +45,71 @@ private:
 };
 
 
+class Expr : public Value {
+public:
+  // How an expression renders as the operand of another one.
+  enum Form {
+    kBinary,
+    kLiteral,
+    kFactorial,
+    kOther,
+  };
+
+  Expr(int64_t value) : Value(value) { }
+  Expr(double value) : Value(value) { }
+  Expr(const Value& value) : Value(value) { }
+
+  virtual std::string ToString() const = 0;
+  virtual Form GetForm() const { return kOther; }
+};
+
+
+// A member of a value-only search, which keeps nothing but the values of its
+// generations. It renders as the expression that the Resolver bound to the
+// rendering thread derives for its value.
+class ValueExpr : public Expr {
+public:
+  class Resolver {
+  public:
+    // Null when no derivation is found.
+    virtual const Expr* Resolve(const ValueExpr& expr) = 0;
+
+  protected:
+    ~Resolver() = default;
+  };
+
+  // Makes the calling thread render through resolver until the binding goes
+  // out of scope.
+  class Binding {
+  public:
+    explicit Binding(Resolver* resolver) : previous_(current_) { current_ = resolver; }
+    ~Binding() { current_ = previous_; }
+
+    Binding(const Binding&) = delete;
+    Binding& operator=(const Binding&) = delete;
+
+  private:
+    Resolver* previous_;
+  };
+
+  explicit ValueExpr(const Value& value) : Expr(value) { }
+
+  virtual std::string ToString() const;
+  virtual Form GetForm() const;
+
+private:
+  static inline thread_local Resolver* current_ = nullptr;
+
+  const Expr* Resolve() const { return current_ != nullptr ? current_->Resolve(*this) : nullptr; }
+};
+
+
 class LiteralExpr : public Expr {
 public:
   LiteralExpr(std::string&& literal);
 
   virtual std::string ToString() const;
+  virtual Form GetForm() const { return kLiteral; }
 
 private:
   std::string literal_;
@@ -41,11 +118,12 @@ private:
 
 class BinaryExpr : public Expr {
 public:
-  BinaryExpr(char oper, const Expr* left, const Expr* right, double value);
+  BinaryExpr(char oper, const Expr* left, const Expr* right, const Value& value);
 
   virtual std::string LeftToString() const;
   virtual std::string RightToString() const;
   virtual std::string ToString() const;
+  virtual Form GetForm() const { return kBinary; }
 
 protected:
   const char oper_;
@@ -125,11 +203,21 @@ public:
 
 class FactorialExpr : public Expr {
 public:
-  static int64_t Factorial(int64_t n);
-
   FactorialExpr(const Expr* expr);
 
   virtual std::string ToString() const;
+  virtual Form GetForm() const { return kFactorial; }
+
+private:
+  const Expr* child_;
+};
+
+
+class DoubleFactorialExpr : public Expr {
+public:
+  DoubleFactorialExpr(const Expr* expr);
+
+  virtual std::string ToString() const;
 
 private:
   const Expr* child_;
@@ -1,12 +1,22 @@
+#include <csignal>
+#include <fstream>
 #include <iostream>
 
 #include "argh.h"
+#include "calibration.h"
+#include "planner.h"
 #include "tchisla-solver.h"
 
 using std::cout;
 using std::cerr;
 using std::endl;
 
+static std::atomic_bool interrupted = false;
+
+static void HandleInterrupt(int) {
+  interrupted.store(true);
+}
+
 void PrintUsage() {
   cout << "Usage: tchisla_solver target [seed]\n"
     << "Options:\n"
@@ -14,13 +24,34 @@ void PrintUsage() {
     << "  -t, --trace                         Print trace of current search generation and the number of reachable values\n"
     << "  -d, --deep_search                   Enable deep search mode, slow but will activate extra search strategies\n"
     << "  -dd, --deeper_search                Enable deeper search mode, slower but will activate all search strategies\n"
+    << "  -a, --auto_search                   Start in normal search mode and escalate to the deeper modes when the target is not found within the escalation depth\n"
+    << "  --escalation-depth=DEPTH            Set the number of generations searched before escalating to a deeper search mode (default: 7)\n"
+    << "  --no-multi-sqrt-power               Disable powers of repeated square roots such as √√x ^ y\n"
+    << "  --double-factorial                  Enable the double factorial n‼ = n * (n - 2) * ...\n"
+    << "  --sort-merge                        Deduplicate each generation by sorting its candidates and merging them with the reachable values instead of probing a hash set\n"
+    << "  --presize-sets                      Grow the hash sets for the forecast size of each generation before it starts instead of resizing them while it runs\n"
+    << "  --value-only                        Keep only the values of the generations and reconstruct the expression of a found target from them\n"
+    << "  --compress-generations              With --value-only, store every built generation as compressed values that the search decodes block by block\n"
     << "  --precision=double_value            Set precision for double's approximation integer and existence test (default: 1e-7)\n"
-    << "  --value-max-limit=double_value      Set maximum limit for reachable values during search, larger values will be ignored (default: 1e12)\n"
+    << "  --value-max-limit=double_value      Set maximum limit for reachable values during search, larger values will be ignored (default: 1e15)\n"
     << "  --value-min-limit=double_value      Set minimum limit for reachable values during search, smaller values will be ignored (default: 1e-8)\n"
     << "  --power-limit=int_value             Set the maximum exponent value for power calculations (default: 40)\n"
-    << "  --factorial-limit=int_value         Set the maximum original value for factorial calculations (default: 15)\n"
+    << "  --factorial-limit=int_value         Set the maximum original value for factorial calculations (default: 20)\n"
     << "  --muilt-threads-threshold=int_value Set the threshold for enabling multi-threading in next generation search when a generation reachable values exceeds this number (default: 10000)\n"
+    << "  --bitmap-limit=int_value            Set the bound below which reachable integers are kept in a dense bitmap instead of the hash set (default: 1048576)\n"
+    << "  --beam-width=int_value              Keep only this many candidates closest to the target per generation, fast and bounded in memory but not always optimal (default: 0, exhaustive)\n"
+    << "  --plan                              Split the target into factors, powers and factorials and look those up in generations built to the plan depth, fast but not always optimal\n"
+    << "  --plan-depth=DEPTH                  Set the number of generations built for the lookups of --plan (default: 7)\n"
+    << "  --iterative-deepening=DEPTH         Store only the generations up to DEPTH and search deeper digit counts one at a time from the target down, slower but bounded in memory and optimal up to 2 * DEPTH + 1 digits\n"
     << "  --search-depth=DEPTH                Set the maximum number of iterations for searching a target value (default: 20)\n"
+    << "  --time-limit=seconds                Stop each search when it runs longer than this wall-clock time (default: unlimited)\n"
+    << "  --max-candidates=int_value          Stop each search when it has collected more reachable values than this (default: unlimited)\n"
+    << "  --memory-limit=megabytes            Stop each search when the solver allocates more memory than this (default: unlimited)\n"
+    << "  --profile=file                      Load the limits above from a profile written by --calibrate, options given on the command line override it\n"
+    << "  --calibrate=file                    Tune the limits above and the multi-threading threshold on a target corpus without losing optimal results, and write them to a profile\n"
+    << "  --calibration-corpus=file           Calibrate on the \"search_mode target seed\" lines of file instead of the built-in corpus\n"
+    << "  --perf-counters                     With --trace, print the cycles, instructions, cache, branch and TLB misses of every worker per generation\n"
+    << "  --timeline=file.json                Record a timeline of every search thread to file in Chrome trace-event format\n"
     << "\n"
     << "Examples:\n"
     << "  tchisla_solver 1234                 Search using digits 1 to 9 to calculate 1234\n"
@@ -40,34 +71,59 @@ int main(int argc, char* argv[]) {
   bool trace = cmdl[{ "-t", "--trace" }];
   bool deep_search = cmdl[{ "-d", "--deep_search" }];
   bool deeper_search = cmdl[{ "-dd", "--deeper_search" }];
-  int search_mode = deeper_search ? 2 : deep_search;
+  bool auto_search = cmdl[{ "-a", "--auto_search" }];
+  int search_mode = auto_search ? TchislaSolver::AUTO_SEARCH_MODE : deeper_search ? 2 : deep_search;
+
+  unsigned operator_options = DEFAULT_OPERATOR_OPTIONS;
+  if (cmdl["no-multi-sqrt-power"]) operator_options &= ~kMultiSqrtPower;
+  if (cmdl["double-factorial"]) operator_options |= kDoubleFactorial;
+  bool sort_merge = cmdl["sort-merge"];
+  bool value_only = cmdl["value-only"];
+  bool compress_generations = cmdl["compress-generations"];
+  bool presize_sets = cmdl["presize-sets"];
+  bool perf_counters = cmdl["perf-counters"];
+
+  TchislaSolver::Config config;
+  std::string profile_path;
+  cmdl("profile") >> profile_path;
+  if (!profile_path.empty()) {
+    std::string error;
+    if (!LoadProfile(profile_path, &config, &error)) {
+      cerr << "Error: " << error << "!" << endl;
+      return 1;
+    }
+  }
 
   double dvalue;
   if (cmdl("precision")) {
     cmdl("precision") >> dvalue;
-    if (0 < dvalue && dvalue < 1) Expr::DOUBLE_PRECISION = dvalue;
+    if (0 < dvalue && dvalue < 1) config.precision = dvalue;
   }
   if (cmdl("value-max-limit")) {
     cmdl("value-max-limit") >> dvalue;
-    if (0 < dvalue) TchislaSolver::VALUE_MAX_LIMIT = dvalue;
+    if (0 < dvalue) config.value_max_limit = dvalue;
   }
   if (cmdl("value-min-limit")) {
     cmdl("value-min-limit") >> dvalue;
-    if (0 < dvalue) TchislaSolver::VALUE_MIN_LIMIT = dvalue;
+    if (0 < dvalue) config.value_min_limit = dvalue;
   }
 
   int64_t ivalue;
   if (cmdl("power-limit")) {
     cmdl("power-limit") >> ivalue;
-    if (0 < ivalue) TchislaSolver::POWER_LIMIT = ivalue;
+    if (0 < ivalue) config.power_limit = ivalue;
   }
   if (cmdl("factorial-limit")) {
     cmdl("factorial-limit") >> ivalue;
-    if (0 < ivalue) TchislaSolver::FACTORIAL_LIMIT = ivalue;
+    if (0 < ivalue) config.factorial_limit = ivalue;
   }
   if (cmdl("muilt-threads-threshold")) {
     cmdl("muilt-threads-threshold") >> ivalue;
-    if (0 < ivalue) TchislaSolver::MUILT_THREADS_THRESHOLD = ivalue;
+    if (0 < ivalue) config.multi_threads_threshold = ivalue;
+  }
+  if (cmdl("bitmap-limit")) {
+    cmdl("bitmap-limit") >> ivalue;
+    if (0 <= ivalue) config.bitmap_limit = ivalue;
   }
   int64_t search_depth = -1;
   if (cmdl("search-depth")) {
@@ -75,6 +131,80 @@ int main(int argc, char* argv[]) {
     if (0 < ivalue) search_depth = ivalue;
   }
 
+  size_t beam_width = 0;
+  if (cmdl("beam-width")) {
+    cmdl("beam-width") >> ivalue;
+    if (0 < ivalue) beam_width = ivalue;
+  }
+
+  int64_t deepening_depth = 0;
+  if (cmdl("iterative-deepening")) {
+    cmdl("iterative-deepening") >> ivalue;
+    if (0 < ivalue) deepening_depth = ivalue;
+  }
+
+  bool plan = cmdl["plan"];
+  int64_t plan_depth = 7;
+  if (cmdl("plan-depth")) {
+    cmdl("plan-depth") >> ivalue;
+    if (0 < ivalue) plan_depth = ivalue;
+  }
+
+  int64_t escalation_depth = 0;
+  if (cmdl("escalation-depth")) {
+    cmdl("escalation-depth") >> ivalue;
+    if (0 < ivalue) escalation_depth = ivalue;
+  }
+
+  double time_limit = 0;
+  if (cmdl("time-limit")) {
+    cmdl("time-limit") >> dvalue;
+    if (0 < dvalue) time_limit = dvalue;
+  }
+  size_t max_candidates = SIZE_MAX;
+  if (cmdl("max-candidates")) {
+    cmdl("max-candidates") >> ivalue;
+    if (0 < ivalue) max_candidates = ivalue;
+  }
+
+  size_t memory_limit = SIZE_MAX;
+  if (cmdl("memory-limit")) {
+    cmdl("memory-limit") >> dvalue;
+    if (0 < dvalue) memory_limit = static_cast<size_t>(dvalue * 1024 * 1024);
+  }
+
+  std::string timeline_path;
+  cmdl("timeline") >> timeline_path;
+  std::ofstream timeline_file;
+  if (!timeline_path.empty()) {
+    timeline_file.open(timeline_path);
+    if (!timeline_file) {
+      cerr << "Error: Cannot open timeline file " << timeline_path << "!" << endl;
+      return 1;
+    }
+  }
+  Timeline timeline;
+
+  std::string calibration_path;
+  cmdl("calibrate") >> calibration_path;
+  if (!calibration_path.empty()) {
+    std::vector<CalibrationCase> corpus = DefaultCalibrationCorpus();
+    std::string corpus_path;
+    cmdl("calibration-corpus") >> corpus_path;
+    std::string error;
+    if (!corpus_path.empty() && !LoadCalibrationCorpus(corpus_path, &corpus, &error)) {
+      cerr << "Error: " << error << "!" << endl;
+      return 1;
+    }
+    TchislaSolver::Config calibrated = Calibrate(corpus, config, &cout);
+    if (!SaveProfile(calibration_path, calibrated)) {
+      cerr << "Error: Cannot write profile " << calibration_path << "!" << endl;
+      return 1;
+    }
+    cout << "Profile written to " << calibration_path << endl;
+    return 0;
+  }
+
   int64_t target;
   if (!(cmdl(1) >> target) || target <= 0) {
       cerr << "Error: A positive target value is required!" << endl;
@@ -89,27 +219,80 @@ int main(int argc, char* argv[]) {
       }
   }
 
-  if (seed != 0) {
-    TchislaSolver ts(target, seed, search_mode, trace ? &cout : nullptr);
-    if (ts.Solve(search_depth > 0 ? search_depth : 20)) {
-      cout << target << '(' << ts.Generations() << ')' << " = " << ts.Result() << endl;
-    } else {
-      cout << "Not Found" << endl;
+  std::signal(SIGINT, HandleInterrupt);
+  auto configure = [&](TchislaSolver& ts) {
+    if (time_limit > 0) {
+      auto limit = std::chrono::duration<double>(time_limit);
+      ts.SetDeadline(TchislaSolver::Clock::now() +
+          std::chrono::duration_cast<TchislaSolver::Clock::duration>(limit));
+    }
+    ts.SetCancellationToken(&interrupted);
+    ts.SetMaxCandidates(max_candidates);
+    ts.SetMemoryLimit(memory_limit);
+    if (escalation_depth > 0) ts.SetEscalationDepth(escalation_depth);
+    ts.SetOperatorOptions(operator_options);
+    if (sort_merge) ts.SetDedupEngine(TchislaSolver::kSortMerge);
+    ts.SetValueOnly(value_only);
+    ts.SetCompressGenerations(compress_generations);
+    ts.SetPresizeSets(presize_sets);
+    ts.SetBeamWidth(beam_width);
+    ts.SetIterativeDeepening(deepening_depth);
+    if (timeline_file.is_open()) ts.SetTimeline(&timeline);
+    ts.SetPerfCounters(trace && perf_counters);
+  };
+  auto print_found = [target, beam_width](const TchislaSolver& ts) {
+    cout << target << '(' << ts.Generations() << ')' << " = " << ts.Result();
+    if (!ts.Status().optimal) {
+      cout << (beam_width > 0 ? " (beam search, may not be optimal)" : " (beyond the complete deepening depth, may not be optimal)");
+    }
+  };
+  auto print_not_found = [](const TchislaSolver& ts) {
+    cout << "Not Found";
+    if (ts.Status().Stopped()) cout << " (" << ts.Status().ToString() << ')';
+  };
+
+  // Prints the result for one seed and returns the digits it uses, 0 if none.
+  auto solve = [&](int64_t seed) -> size_t {
+    if (plan) {
+      TchislaPlanner planner(config, target, seed, search_mode, plan_depth, 2, trace ? &cout : nullptr);
+      configure(planner.Cache());
+      if (!planner.Plan()) {
+        print_not_found(planner.Cache());
+        return 0;
+      }
+      cout << target << '(' << planner.Digits() << ')' << " = " << planner.Result();
+      if (!planner.Optimal()) {
+        cout << " (planned, may not be optimal)";
+        for (const auto& sub_solve : planner.SubSolves()) {
+          cout << "\n  " << sub_solve.value << '(' << sub_solve.digits << ')' << " = " << sub_solve.expression;
+        }
+      }
+      return planner.Digits();
     }
+    TchislaSolver ts(config, target, seed, search_mode, trace ? &cout : nullptr);
+    configure(ts);
+    if (!ts.Solve(search_depth > 0 ? search_depth : 20)) {
+      print_not_found(ts);
+      return 0;
+    }
+    print_found(ts);
+    return ts.Generations();
+  };
+
+  if (seed != 0) {
+    solve(seed);
+    cout << endl;
   } else {
     size_t total = 0;
-    for (int i = 1; i <= 9; ++i) {
-      TchislaSolver ts(target, i, search_mode, trace ? &cout : nullptr);
-      if (ts.Solve(search_depth > 0 ? search_depth : 20)) {
-        total += ts.Generations();
-        cout << target << '(' << ts.Generations() << ')' << " = " << ts.Result();
-      } else {
-        cout << "Not Found";
-      }
+    for (int i = 1; i <= 9 && !interrupted.load(); ++i) {
+      total += solve(i);
       cout << '\n' << endl;
     }
     cout << "Total digits used: " << total << endl;
   }
 
+  if (timeline_file.is_open()) {
+    timeline.Write(timeline_file);
+  }
   return 0;
 }
@@ -0,0 +1,493 @@
+﻿#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "expr.h"
+
+
+// Everything an operator may depend on besides its operands.
+struct OperatorContext {
+  int64_t seed;
+  double precision;
+  int64_t power_limit;
+  int64_t factorial_limit;
+};
+
+
+// Operators a run can add to or drop from the default set of the game.
+enum OperatorOption : unsigned {
+  kMultiSqrtPower = 1 << 0,
+  kDoubleFactorial = 1 << 1,
+};
+
+constexpr unsigned DEFAULT_OPERATOR_OPTIONS = kMultiSqrtPower;
+
+
+// Every operator is described by a struct with
+//   ARITY       the number of operands,
+//   ExprType    the Expr subclass that stores and renders its results,
+//   Family      operators of a family only differ in the results they keep,
+//   Evaluate()  its value, exact for integer operands wherever possible,
+//   Admits()    whether it applies to the operands,
+//   Keeps()     whether a result is worth a candidate,
+//   Solve*()    its inverse, the operand that gives a result, NaN if none,
+//   Apply<S>()  emitting its candidates for an operand pair through a creator.
+// The CRTP bases below provide defaults for Family, Admits, Keeps and Apply.
+// Binary operators also have ApplyOrdered<S>(), which only emits op(left,
+// right), and EXPONENT_MAJOR, see OperatorList::Apply().
+// Operators are assembled into OperatorLists at compile time, so the search
+// loops call every operator of a list directly and skip the others entirely.
+
+template<class Op>
+struct BinaryOperator {
+  static constexpr int ARITY = 2;
+  static constexpr bool COMMUTATIVE = false;
+  static constexpr bool EXPONENT_MAJOR = false;
+  using Family = Op;
+
+  static bool Admits(const Value&, const Value&, const OperatorContext&) { return true; }
+  static bool Keeps(const Value&, const Value&, const Value&, const OperatorContext&) { return true; }
+
+  // Emits op(left, right) and, unless the operator commutes, op(right, left).
+  template<class S, class Creator>
+  static bool Apply(Creator& creator, const Expr* left, const Expr* right) {
+    if (Op::template ApplyOrdered<S>(creator, left, right)) return true;
+    if constexpr (!Op::COMMUTATIVE) {
+      if (Op::template ApplyOrdered<S>(creator, right, left)) return true;
+    }
+    return false;
+  }
+
+  template<class S, class Creator>
+  static bool ApplyOrdered(Creator& creator, const Expr* left, const Expr* right) {
+    return Op::Admits(*left, *right, creator.context) && creator.template Emit<S, Op>(left, right);
+  }
+};
+
+template<class Op>
+struct UnaryOperator {
+  static constexpr int ARITY = 1;
+  using Family = Op;
+
+  static bool Keeps(const Value&, const Value&, const OperatorContext&) { return true; }
+
+  template<class S, class Creator>
+  static bool Apply(Creator& creator, const Expr* operand) {
+    return Op::Admits(*operand, creator.context) && creator.template Emit<S, Op>(operand);
+  }
+};
+
+
+// Integer power with overflow detection, exponent must not be negative.
+inline bool IntegerPower(int64_t base, int64_t exponent, int64_t* result) {
+  int64_t power = 1;
+  while (exponent > 0) {
+    if ((exponent & 1) != 0 && __builtin_mul_overflow(power, base, &power)) return false;
+    exponent >>= 1;
+    if (exponent > 0 && __builtin_mul_overflow(base, base, &base)) return false;
+  }
+  *result = power;
+  return true;
+}
+
+inline Value PowerValue(const Value& base, int64_t exponent) {
+  int64_t power;
+  if (base.IsInt() && IntegerPower(base.GetIntUnsafe(), exponent, &power)) return Value(power);
+  return Value(std::pow(base.GetDouble(), static_cast<double>(exponent)));
+}
+
+
+struct AdditionOperator : BinaryOperator<AdditionOperator> {
+  using ExprType = AddExpr;
+  static constexpr bool COMMUTATIVE = true;
+
+  static Value Evaluate(const Value& left, const Value& right) {
+    int64_t sum;
+    if (left.IsInt() && right.IsInt() &&
+        !__builtin_add_overflow(left.GetIntUnsafe(), right.GetIntUnsafe(), &sum)) return Value(sum);
+    return Value(left.GetDouble() + right.GetDouble());
+  }
+
+  static double SolveLeft(double result, double right) { return result - right; }
+  static double SolveRight(double result, double left) { return result - left; }
+};
+
+
+// Only the non-negative difference is emitted.
+struct SubtractionOperator : BinaryOperator<SubtractionOperator> {
+  using ExprType = SubExpr;
+
+  static bool Admits(const Value& left, const Value& right, const OperatorContext&) {
+    return left.GetDouble() > right.GetDouble();
+  }
+
+  static Value Evaluate(const Value& left, const Value& right) {
+    int64_t difference;
+    if (left.IsInt() && right.IsInt() &&
+        !__builtin_sub_overflow(left.GetIntUnsafe(), right.GetIntUnsafe(), &difference)) {
+      return Value(difference);
+    }
+    return Value(left.GetDouble() - right.GetDouble());
+  }
+
+  static double SolveLeft(double result, double right) { return result + right; }
+  static double SolveRight(double result, double left) { return left - result; }
+};
+
+
+struct MultiplicationOperator : BinaryOperator<MultiplicationOperator> {
+  using ExprType = MulExpr;
+  static constexpr bool COMMUTATIVE = true;
+
+  static Value Evaluate(const Value& left, const Value& right) {
+    int64_t product;
+    if (left.IsInt() && right.IsInt() &&
+        !__builtin_mul_overflow(left.GetIntUnsafe(), right.GetIntUnsafe(), &product)) {
+      return Value(product);
+    }
+    return Value(left.GetDouble() * right.GetDouble());
+  }
+
+  static double SolveLeft(double result, double right) { return result / right; }
+  static double SolveRight(double result, double left) { return result / left; }
+};
+
+
+struct DivisionOperator : BinaryOperator<DivisionOperator> {
+  using ExprType = DivExpr;
+
+  static bool Admits(const Value& left, const Value& right, const OperatorContext& context) {
+    return left.GetDouble() >= context.precision && right.GetDouble() >= context.precision;
+  }
+
+  static Value Evaluate(const Value& left, const Value& right) {
+    if (left.IsInt() && right.IsInt() && right.GetIntUnsafe() != 0 &&
+        left.GetIntUnsafe() % right.GetIntUnsafe() == 0) {
+      return Value(left.GetIntUnsafe() / right.GetIntUnsafe());
+    }
+    return Value(left.GetDouble() / right.GetDouble());
+  }
+
+  static double SolveLeft(double result, double right) { return result * right; }
+  static double SolveRight(double result, double left) { return left / result; }
+};
+
+
+struct PowerOperator : BinaryOperator<PowerOperator> {
+  using ExprType = PowExpr;
+  static constexpr bool EXPONENT_MAJOR = true;
+
+  static bool Admits(const Value&, const Value& exponent, const OperatorContext& context) {
+    return exponent.IsInt() && exponent.GetIntUnsafe() <= context.power_limit;
+  }
+
+  static Value Evaluate(const Value& base, const Value& exponent) {
+    if (exponent.IsInt() && exponent.GetIntUnsafe() >= 0) return PowerValue(base, exponent.GetIntUnsafe());
+    return Value(std::pow(base.GetDouble(), exponent.GetDouble()));
+  }
+
+  static double SolveLeft(double result, double exponent) { return std::pow(result, 1 / exponent); }
+  static double SolveRight(double result, double base) { return std::log(result) / std::log(base); }
+};
+
+
+struct NegativePowerOperator : BinaryOperator<NegativePowerOperator> {
+  using ExprType = NegPowExpr;
+  static constexpr bool EXPONENT_MAJOR = true;
+
+  static bool Admits(const Value& base, const Value& exponent, const OperatorContext& context) {
+    return PowerOperator::Admits(base, exponent, context);
+  }
+
+  static Value Evaluate(const Value& base, const Value& exponent) {
+    return Value(1.0 / std::pow(base.GetDouble(), exponent.GetDouble()));
+  }
+
+  static double SolveLeft(double result, double exponent) { return std::pow(result, -1 / exponent); }
+  static double SolveRight(double result, double base) { return -std::log(result) / std::log(base); }
+};
+
+
+// √...√(base) ^ exponent and its reciprocal for every square root count that
+// divides an even exponent. Without NonIntegerResults only integer powers are
+// kept.
+template<bool NonIntegerResults>
+struct MultiSqrtPowerOperator : BinaryOperator<MultiSqrtPowerOperator<NonIntegerResults>> {
+  using ExprType = MultiSqrtPowExpr;
+  static constexpr bool EXPONENT_MAJOR = true;
+  using Family = MultiSqrtPowerOperator<true>;
+
+  static bool Admits(const Value&, const Value& exponent, const OperatorContext&) {
+    return exponent.IsInt() && exponent.GetIntUnsafe() > 0;
+  }
+
+  static bool Keeps(const Value& result, const Value&, const Value&, const OperatorContext&) {
+    return NonIntegerResults || result.IsInt();
+  }
+
+  static Value Evaluate(int sqrt_times, const Value& base, const Value& exponent) {
+    return PowerValue(base, exponent.GetInt() >> sqrt_times);
+  }
+
+  // Not the reciprocal of Evaluate(), whose tiny powers already round to zero.
+  static Value EvaluateReciprocal(int sqrt_times, const Value& base, const Value& exponent) {
+    return Value(1.0 / std::pow(base.GetDouble(), static_cast<double>(exponent.GetInt() >> sqrt_times)));
+  }
+
+  static double SolveLeft(int sqrt_times, double result, double exponent) {
+    return std::pow(result, std::ldexp(1, sqrt_times) / exponent);
+  }
+  static double SolveRight(int sqrt_times, double result, double base) {
+    return std::ldexp(std::log(result) / std::log(base), sqrt_times);
+  }
+
+  template<class S, class Creator>
+  static bool ApplyOrdered(Creator& creator, const Expr* base, const Expr* exponent) {
+    if (!Admits(*base, *exponent, creator.context)) return false;
+    int64_t power = exponent->GetIntUnsafe();
+    int sqrt_times = 0;
+    while ((power & 1) == 0) {
+      power >>= 1;
+      ++sqrt_times;
+      const Expr* expr = creator.template Make<S, MultiSqrtPowExpr>(sqrt_times, base, exponent);
+      if (!Keeps(*expr, *base, *exponent, creator.context)) continue;
+      bool new_operator = creator.template IsNewOperator<S, MultiSqrtPowerOperator>(*expr, *base, *exponent);
+      if (creator.template AddCandidate<S>(expr, new_operator)) return true;
+      expr = creator.template Make<S, NegMultiSqrtPowExpr>(sqrt_times, base, exponent);
+      if (creator.template AddCandidate<S>(expr, new_operator)) return true;
+    }
+    return false;
+  }
+};
+
+
+// left * √right, only kept when the root cancels into an integer.
+struct SqrtMultiplicationOperator : BinaryOperator<SqrtMultiplicationOperator> {
+  using ExprType = SqrtMulExpr;
+
+  static bool Admits(const Value&, const Value& right, const OperatorContext&) {
+    return !right.IsInt();
+  }
+
+  static bool Keeps(const Value& result, const Value&, const Value&, const OperatorContext&) {
+    return result.IsInt();
+  }
+
+  static Value Evaluate(const Value& left, const Value& right) {
+    return Value(left.GetDouble() * std::sqrt(right.GetDouble()));
+  }
+
+  static double SolveLeft(double result, double right) { return result / std::sqrt(right); }
+  static double SolveRight(double result, double left) { return (result / left) * (result / left); }
+
+  // The root of the left operand comes first.
+  template<class S, class Creator>
+  static bool Apply(Creator& creator, const Expr* left, const Expr* right) {
+    return BinaryOperator::Apply<S>(creator, right, left);
+  }
+};
+
+
+struct FactorialOperator : UnaryOperator<FactorialOperator> {
+  using ExprType = FactorialExpr;
+
+  static constexpr int TABLE_SIZE = 21;
+
+  static constexpr std::array<int64_t, TABLE_SIZE> Table() {
+    std::array<int64_t, TABLE_SIZE> table = {};
+    table[0] = 1;
+    for (int n = 1; n < TABLE_SIZE; ++n) table[n] = table[n - 1] * n;
+    return table;
+  }
+
+  // 1! and 2! are fixed points, skipping them also bounds unary chains of
+  // streamed candidates which are not deduplicated.
+  static bool Admits(const Value& operand, const OperatorContext& context) {
+    return operand.IsInt() && operand.GetIntUnsafe() > 2 && operand.GetIntUnsafe() <= context.factorial_limit;
+  }
+
+  static Value Evaluate(const Value& operand) {
+    static constexpr auto table = Table();
+    int64_t n = operand.GetInt();
+    if (0 <= n && n < TABLE_SIZE) return Value(table[n]);
+    return Value(std::tgamma(static_cast<double>(n) + 1));
+  }
+
+  static double SolveOperand(double result) {
+    static constexpr auto table = Table();
+    for (int n = 3; n < TABLE_SIZE; ++n) {
+      if (static_cast<double>(table[n]) == result) return n;
+    }
+    return NAN;
+  }
+};
+
+
+// n!! = n * (n - 2) * (n - 4) * ..., not part of the original game.
+struct DoubleFactorialOperator : UnaryOperator<DoubleFactorialOperator> {
+  using ExprType = DoubleFactorialExpr;
+
+  // 3!! = 3 is the last fixed point, the limit matches that of the factorial
+  // since n!! is roughly the square root of n!.
+  static bool Admits(const Value& operand, const OperatorContext& context) {
+    return operand.IsInt() && operand.GetIntUnsafe() > 3 && operand.GetIntUnsafe() <= 2 * context.factorial_limit;
+  }
+
+  static Value Evaluate(const Value& operand) {
+    int64_t product = 1;
+    for (int64_t n = operand.GetInt(); n > 1; n -= 2) {
+      if (__builtin_mul_overflow(product, n, &product)) return Value(HUGE_VAL);
+    }
+    return Value(product);
+  }
+
+  static double SolveOperand(double result) {
+    for (int64_t n = 4; n <= 60; ++n) {
+      Value value = Evaluate(Value(n));
+      if (!value.IsInt()) break;
+      if (static_cast<double>(value.GetIntUnsafe()) == result) return static_cast<double>(n);
+    }
+    return NAN;
+  }
+};
+
+
+// Which square roots of integers are kept: only integer ones, also any root
+// of the seed, or all of them.
+enum class RootPolicy {
+  kIntegers,
+  kSeed,
+  kAll,
+};
+
+template<RootPolicy Roots>
+struct SquareRootOperator : UnaryOperator<SquareRootOperator<Roots>> {
+  using ExprType = SqrtExpr;
+  using Family = SquareRootOperator<RootPolicy::kAll>;
+
+  static bool Admits(const Value& operand, const OperatorContext&) {
+    return operand.IsInt() && operand.GetIntUnsafe() > 1;
+  }
+
+  static bool Keeps(const Value& result, const Value& operand, const OperatorContext& context) {
+    return Roots == RootPolicy::kAll || result.IsInt() ||
+      (Roots == RootPolicy::kSeed && operand.GetInt() == context.seed);
+  }
+
+  // Perfect squares already round back to integers within the precision.
+  static Value Evaluate(const Value& operand) {
+    return Value(std::sqrt(operand.GetDouble()));
+  }
+
+  static double SolveOperand(double result) { return result * result; }
+};
+
+// √√operand, integer double roots already come out of two square roots.
+template<RootPolicy Roots>
+struct DoubleSquareRootOperator : UnaryOperator<DoubleSquareRootOperator<Roots>> {
+  using ExprType = DoubleSqrtExpr;
+  using Family = DoubleSquareRootOperator<RootPolicy::kAll>;
+
+  static bool Admits(const Value& operand, const OperatorContext& context) {
+    return operand.IsInt() && operand.GetIntUnsafe() > 1 &&
+      (Roots == RootPolicy::kAll || (Roots == RootPolicy::kSeed && operand.GetIntUnsafe() == context.seed));
+  }
+
+  static Value Evaluate(const Value& operand) {
+    return Value(std::sqrt(std::sqrt(operand.GetDouble())));
+  }
+
+  static double SolveOperand(double result) { return result * result * result * result; }
+};
+
+
+template<class... Ops>
+struct OperatorList {
+  template<class Op>
+  static constexpr bool CONTAINS = (std::is_same_v<Op, Ops> || ...);
+
+  // Applies every operator of the list in order, until one finds the target.
+  // The exponent-major operators, the powers, come last in every list and are
+  // applied with the right operand as exponent before any of them takes the
+  // left one.
+  template<class S, class Creator, class... Operands>
+  static bool Apply(Creator& creator, const Operands*... operands) {
+    if constexpr (sizeof...(Operands) == 2) {
+      return (ApplyOne<S, Ops>(creator, operands...) || ...) || ApplyExponents<S>(creator, operands...);
+    } else {
+      return (ApplyOne<S, Ops>(creator, operands...) || ...);
+    }
+  }
+
+  // Calls f with a null pointer to every operator of the list in order, until
+  // f returns true.
+  template<class F>
+  static bool Any(const F& f) {
+    return (f(static_cast<Ops*>(nullptr)) || ...);
+  }
+
+  // Whether an operator of the family in this list keeps the result.
+  template<class Family, class... Values>
+  static bool FamilyKeeps(const OperatorContext& context, const Values&... values) {
+    return (KeepsIfFamily<Family, Ops>(context, values...) || ...);
+  }
+
+private:
+  template<class S, class Op, class Creator, class... Operands>
+  static bool ApplyOne(Creator& creator, const Operands*... operands) {
+    if constexpr (sizeof...(Operands) != Op::ARITY || S::template SKIPS<Op>) {
+      return false;
+    } else if constexpr (Op::ARITY == 1) {
+      return Op::template Apply<S>(creator, operands...);
+    } else if constexpr (Op::EXPONENT_MAJOR) {
+      return false;
+    } else {
+      return Op::template Apply<S>(creator, operands...);
+    }
+  }
+
+  template<class S, class Creator>
+  static bool ApplyExponents(Creator& creator, const Expr* left, const Expr* right) {
+    return (ApplyExponent<S, Ops>(creator, left, right) || ...) ||
+      (ApplyExponent<S, Ops>(creator, right, left) || ...);
+  }
+
+  template<class S, class Op, class Creator>
+  static bool ApplyExponent(Creator& creator, const Expr* base, const Expr* exponent) {
+    if constexpr (Op::ARITY != 2 || S::template SKIPS<Op>) {
+      return false;
+    } else if constexpr (!Op::EXPONENT_MAJOR) {
+      return false;
+    } else {
+      return Op::template ApplyOrdered<S>(creator, base, exponent);
+    }
+  }
+
+  template<class Family, class Op, class... Values>
+  static bool KeepsIfFamily(const OperatorContext& context, const Values&... values) {
+    if constexpr (std::is_same_v<Family, typename Op::Family>) {
+      return Op::Keeps(values..., context);
+    } else {
+      return false;
+    }
+  }
+};
+
+template<class... Lists>
+struct ConcatOperators;
+
+template<class... Ops>
+struct ConcatOperators<OperatorList<Ops...>> {
+  using type = OperatorList<Ops...>;
+};
+
+template<class... Ops1, class... Ops2, class... Rest>
+struct ConcatOperators<OperatorList<Ops1...>, OperatorList<Ops2...>, Rest...> {
+  using type = typename ConcatOperators<OperatorList<Ops1..., Ops2...>, Rest...>::type;
+};
+
+template<bool Enabled, class... Ops>
+using OperatorsIf = std::conditional_t<Enabled, OperatorList<Ops...>, OperatorList<>>;
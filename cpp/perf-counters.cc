@@ -0,0 +1,123 @@
+﻿#include "perf-counters.h"
+
+#include <sstream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+using std::string;
+
+static const char* const EVENT_NAMES[PerfCounters::NUM_EVENTS] = {
+  "cycles", "instructions", "LLC misses", "branch misses", "dTLB misses"
+};
+
+static string FormatCount(uint64_t count) {
+  std::ostringstream ss;
+  ss.precision(3);
+  if (count < 1000) ss << count;
+  else if (count < 1000000) ss << count / 1e3 << 'K';
+  else if (count < 1000000000) ss << count / 1e6 << 'M';
+  else ss << count / 1e9 << 'G';
+  return ss.str();
+}
+
+PerfCounters::Counts& PerfCounters::Counts::operator+=(const Counts& other) {
+  for (int e = 0; e < NUM_EVENTS; ++e) values[e] += other.values[e];
+  available |= other.available;
+  return *this;
+}
+
+string PerfCounters::Counts::ToString() const {
+  if (Empty()) return "hardware counters unavailable";
+  std::ostringstream ss;
+  for (int e = 0; e < NUM_EVENTS; ++e) {
+    if (e > 0) ss << ", ";
+    if (available & (1u << e)) ss << FormatCount(values[e]) << ' ' << EVENT_NAMES[e];
+    else ss << EVENT_NAMES[e] << " n/a";
+    if (e == kInstructions && (available & (1u << kCycles)) && (available & (1u << kInstructions)) &&
+        values[kCycles] != 0) {
+      ss.precision(3);
+      ss << " (IPC " << static_cast<double>(values[kInstructions]) / values[kCycles] << ')';
+    }
+  }
+  return ss.str();
+}
+
+#ifdef __linux__
+
+static void Describe(int event, perf_event_attr* attr) {
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->type = PERF_TYPE_HARDWARE;
+  switch (event) {
+  case PerfCounters::kCycles: attr->config = PERF_COUNT_HW_CPU_CYCLES; break;
+  case PerfCounters::kInstructions: attr->config = PERF_COUNT_HW_INSTRUCTIONS; break;
+  case PerfCounters::kLlcMisses: attr->config = PERF_COUNT_HW_CACHE_MISSES; break;
+  case PerfCounters::kBranchMisses: attr->config = PERF_COUNT_HW_BRANCH_MISSES; break;
+  case PerfCounters::kDtlbMisses:
+    attr->type = PERF_TYPE_HW_CACHE;
+    attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  }
+  // Only the leader starts disabled, the group is enabled as a whole.
+  attr->disabled = event == PerfCounters::kCycles;
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+}
+
+// Every counter is one member of a group led by the cycles, so they are all
+// scheduled onto the hardware together and can be read with one read(2).
+PerfCounters::Scope::Scope(Counts* counts) : counts_(counts) {
+  for (int& fd : fds_) fd = -1;
+  if (counts_ == nullptr) return;
+  perf_event_attr attr;
+  for (int e = 0; e < NUM_EVENTS; ++e) {
+    Describe(e, &attr);
+    fds_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, fds_[kCycles], 0));
+    if (fds_[kCycles] < 0) return;
+  }
+  ioctl(fds_[kCycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds_[kCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::Scope::~Scope() {
+  if (fds_[kCycles] >= 0) {
+    ioctl(fds_[kCycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // The values follow the order in which the members joined the group.
+    uint64_t data[3 + NUM_EVENTS];
+    ssize_t size = read(fds_[kCycles], data, sizeof(data));
+    if (size >= static_cast<ssize_t>(3 * sizeof(uint64_t)) && data[2] != 0) {
+      uint64_t enabled = data[1], running = data[2];
+      size_t member = 0;
+      for (int e = 0; e < NUM_EVENTS && member < data[0]; ++e) {
+        if (fds_[e] < 0) continue;
+        uint64_t value = data[3 + member++];
+        // Scales counts up for the time the group was multiplexed out.
+        if (running < enabled) value = static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+        counts_->values[e] += value;
+        counts_->available |= 1u << e;
+      }
+    }
+  }
+  for (int fd : fds_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+#else
+
+PerfCounters::Scope::Scope(Counts* counts) : counts_(counts) {
+  for (int& fd : fds_) fd = -1;
+}
+
+PerfCounters::Scope::~Scope() { }
+
+#endif
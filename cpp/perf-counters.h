@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+// Hardware performance counters of the calling thread, read with
+// perf_event_open(2): cycles, instructions, last level cache misses, branch
+// misses and data TLB misses, counted in user space only.
+//
+// A Scope opens the counters of the thread it is created on and adds what they
+// counted to a Counts when it goes out of scope, so every thread that does
+// work keeps its own Counts and no counter is shared. Counters the kernel or
+// the hardware does not offer, e.g. inside most virtual machines, are left out
+// and reported as unavailable.
+class PerfCounters {
+public:
+  enum Event { kCycles, kInstructions, kLlcMisses, kBranchMisses, kDtlbMisses, NUM_EVENTS };
+
+  struct Counts {
+    uint64_t values[NUM_EVENTS] = {};
+    // Bit e is set when event e was counted at least once.
+    unsigned available = 0;
+
+    Counts& operator+=(const Counts& other);
+    bool Empty() const { return available == 0; }
+    std::string ToString() const;
+  };
+
+  class Scope {
+  public:
+    // A null counts counts nothing and opens no counter.
+    explicit Scope(Counts* counts);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Counts* counts_;
+    int fds_[NUM_EVENTS];
+  };
+};
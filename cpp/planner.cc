@@ -0,0 +1,176 @@
+﻿#include "planner.h"
+
+#include <cmath>
+
+#include "operators.h"
+
+using std::vector;
+
+// Trial division stops here, a larger cofactor is kept as a single factor.
+constexpr int64_t MAX_TRIAL_DIVISOR = 1000000;
+// Bounds the divisor pairs tried per value.
+constexpr size_t MAX_DIVISORS = 4096;
+constexpr int MAX_EXPONENT = 62;
+
+// floor(value ^ (1 / k)).
+static int64_t IntegerRoot(int64_t value, int k) {
+  int64_t root = static_cast<int64_t>(std::pow(static_cast<double>(value), 1.0 / k));
+  int64_t power;
+  while (root > 1 && !(IntegerPower(root, k, &power) && power <= value)) --root;
+  while (IntegerPower(root + 1, k, &power) && power <= value) ++root;
+  return root;
+}
+
+static vector<int64_t> Divisors(int64_t value) {
+  vector<std::pair<int64_t, int>> factors;
+  int64_t rest = value;
+  for (int64_t p = 2; p <= MAX_TRIAL_DIVISOR && p * p <= rest; ++p) {
+    if (rest % p != 0) continue;
+    factors.push_back({ p, 0 });
+    while (rest % p == 0) {
+      rest /= p;
+      ++factors.back().second;
+    }
+  }
+  if (rest > 1) factors.push_back({ rest, 1 });
+  vector<int64_t> divisors = { 1 };
+  for (const auto& [p, count] : factors) {
+    size_t size = divisors.size();
+    int64_t power = 1;
+    for (int i = 0; i < count && divisors.size() < MAX_DIVISORS; ++i) {
+      power *= p;
+      for (size_t j = 0; j < size && divisors.size() < MAX_DIVISORS; ++j) {
+        divisors.push_back(divisors[j] * power);
+      }
+    }
+  }
+  return divisors;
+}
+
+TchislaPlanner::TchislaPlanner(const TchislaSolver::Config& config, int64_t target, int64_t seed,
+    int search_mode, int cache_depth, int levels, std::ostream* trace_os)
+  : target_(target), cache_depth_(cache_depth), levels_(levels),
+  cache_(config, target, seed, search_mode, trace_os) {
+}
+
+bool TchislaPlanner::Plan() {
+  // The plan renders members of the generations on their own, which a
+  // value-only solver only knows the values of.
+  cache_.SetValueOnly(false);
+  if (cache_.BuildGenerations(cache_depth_)) {
+    result_ = cache_.Result();
+    digits_ = cache_.Generations();
+    optimal_ = true;
+    return true;
+  }
+  if (cache_.Status().Stopped()) return false;
+  Value::PrecisionBinding precision(cache_.GetConfig().precision);
+  cache_.ForEachMember([&](const Expr* expr, size_t digits) {
+    if (expr->IsInt()) members_.emplace(expr->GetIntUnsafe(), std::make_pair(digits, expr));
+  });
+  Node plan = PlanValue(target_, levels_);
+  if (plan.expr == nullptr) return false;
+  result_ = plan.expr->ToString();
+  digits_ = plan.digits;
+  for (int64_t leaf : plan.leaves) {
+    const auto& member = members_.at(leaf);
+    sub_solves_.push_back({ leaf, member.first, member.second->ToString() });
+  }
+  return true;
+}
+
+// A member of the generations is already the cheapest expression for its value,
+// every other one is split at most level more times.
+TchislaPlanner::Node TchislaPlanner::PlanValue(int64_t value, int level) {
+  auto planned = plans_.find(value);
+  if (planned != plans_.end() && planned->second.level >= level) return planned->second;
+  Node best;
+  best.level = level;
+  auto member = members_.find(value);
+  if (member != members_.end()) {
+    best.digits = member->second.first;
+    best.expr = member->second.second;
+    best.leaves = { value };
+    best.level = INT32_MAX;
+  } else if (level > 0 && value > 0) {
+    for (int k = 2; k <= MAX_EXPONENT; ++k) {
+      int64_t root = IntegerRoot(value, k);
+      if (root < 2) break;
+      int64_t power;
+      if (IntegerPower(root, k, &power) && power == value) {
+        Consider<PowExpr>(value, PlanValue(root, level - 1), PlanValue(k, level - 1), &best);
+      }
+    }
+
+    for (int64_t divisor : Divisors(value)) {
+      if (divisor > 1 && divisor <= value / divisor) {
+        Consider<MulExpr>(value, PlanValue(divisor, level - 1), PlanValue(value / divisor, level - 1), &best);
+      }
+    }
+
+    // value = anchor ± rest for the perfect powers and factorials around it.
+    auto around = [&](int64_t anchor_value, const Node& anchor) {
+      if (anchor.expr == nullptr || anchor_value == value || anchor.digits >= best.digits) return;
+      if (anchor_value < value) {
+        Consider<AddExpr>(value, anchor, PlanValue(value - anchor_value, level - 1), &best);
+      } else if (anchor_value - value < value) {
+        Consider<SubExpr>(value, anchor, PlanValue(anchor_value - value, level - 1), &best);
+      }
+    };
+    for (int k = 2; k <= MAX_EXPONENT; ++k) {
+      int64_t root = IntegerRoot(value, k);
+      if (root < 2) break;
+      for (int64_t base = root; base <= root + 1; ++base) {
+        int64_t power;
+        if (!IntegerPower(base, k, &power)) continue;
+        Node anchor;
+        Consider<PowExpr>(power, PlanValue(base, level - 1), PlanValue(k, level - 1), &anchor);
+        around(power, anchor);
+      }
+    }
+
+    for (int64_t m = 3; m < FactorialOperator::TABLE_SIZE; ++m) {
+      int64_t factorial = FactorialOperator::Table()[m];
+      Node anchor = Factorial(PlanValue(m, level - 1));
+      if (factorial == value) {
+        if (anchor.digits < best.digits) best = anchor;
+        continue;
+      }
+      around(factorial, anchor);
+      if (factorial % value == 0 && anchor.expr != nullptr) {
+        Consider<DivExpr>(value, anchor, PlanValue(factorial / value, level - 1), &best);
+      }
+    }
+    best.level = level;
+  }
+  plans_[value] = best;
+  return best;
+}
+
+TchislaPlanner::Node TchislaPlanner::Factorial(const Node& operand) {
+  Node node;
+  if (operand.expr == nullptr || !operand.expr->IsInt() || operand.expr->GetIntUnsafe() < 3 ||
+      operand.expr->GetIntUnsafe() >= FactorialOperator::TABLE_SIZE) {
+    return node;
+  }
+  node.digits = operand.digits;
+  node.expr = pool_.EmplaceObject<FactorialExpr>(operand.expr);
+  pool_.CommitLastObject();
+  node.leaves = operand.leaves;
+  return node;
+}
+
+// Keeps T(left, right) in best if it is cheaper and has exactly the value.
+template<class T>
+void TchislaPlanner::Consider(int64_t value, const Node& left, const Node& right, Node* best) {
+  if (left.expr == nullptr || right.expr == nullptr) return;
+  size_t digits = left.digits + right.digits;
+  if (digits >= best->digits) return;
+  const Expr* expr = pool_.EmplaceObject<T>(left.expr, right.expr);
+  if (!expr->IsInt() || expr->GetIntUnsafe() != value) return;
+  pool_.CommitLastObject();
+  best->digits = digits;
+  best->expr = expr;
+  best->leaves = left.leaves;
+  best->leaves.insert(best->leaves.end(), right.leaves.begin(), right.leaves.end());
+}
@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "expr.h"
+#include "tchisla-solver.h"
+#include "util.h"
+
+
+// Finds short expressions for targets beyond the reach of the exhaustive search
+// by splitting them into sub-targets: a ^ k, products of divisors, sums and
+// differences with a nearby perfect power or factorial, and m! / d. Sub-targets
+// are looked up among the generations of one TchislaSolver per seed, built once
+// to the cache depth, and split again up to a number of levels. The cheapest
+// plan is an upper bound on the digits of the target, not necessarily optimal.
+class TchislaPlanner {
+public:
+  // A sub-target the plan takes from the generations.
+  struct SubSolve {
+    int64_t value;
+    size_t digits;
+    std::string expression;
+  };
+
+  TchislaPlanner(const TchislaSolver::Config& config, int64_t target, int64_t seed, int search_mode,
+      int cache_depth, int levels = 2, std::ostream* trace_os = nullptr);
+
+  bool Plan();
+
+  std::string Result() const { return result_; }
+  size_t Digits() const { return digits_; }
+  // Whether the target was found in the generations themselves, the search of
+  // the cache is exhaustive then.
+  bool Optimal() const { return optimal_; }
+  const std::vector<SubSolve>& SubSolves() const { return sub_solves_; }
+  // The solver that holds the generations, to configure it before Plan() and
+  // for its status and memory usage. Plan() turns value-only storage off.
+  TchislaSolver& Cache() { return cache_; }
+  const TchislaSolver& Cache() const { return cache_; }
+
+private:
+  struct Node {
+    size_t digits = SIZE_MAX;
+    const Expr* expr = nullptr;
+    // Values taken from the generations.
+    std::vector<int64_t> leaves;
+    int level = -1;
+  };
+
+  const int64_t target_;
+  const int cache_depth_;
+  const int levels_;
+  TchislaSolver cache_;
+  std::unordered_map<int64_t, std::pair<size_t, const Expr*>> members_;
+  std::unordered_map<int64_t, Node> plans_;
+  ObjectPool<> pool_;
+
+  std::string result_;
+  size_t digits_ = 0;
+  bool optimal_ = false;
+  std::vector<SubSolve> sub_solves_;
+
+  Node PlanValue(int64_t value, int level);
+  Node Factorial(const Node& operand);
+  template<class T> void Consider(int64_t value, const Node& left, const Node& right, Node* best);
+};
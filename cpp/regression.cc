@@ -0,0 +1,561 @@
+﻿#include "calibration.h"
+#include "planner.h"
+#include "tchisla-solver.h"
+#include "tchisla.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct RegressionCase {
+  int search_mode;
+  int64_t target;
+  int64_t seed;
+  size_t digits;
+  // Envelopes measured on a single core, see TIME_TOLERANCE and MEMORY_TOLERANCE.
+  long envelope_ms;
+  long envelope_kb;
+  unsigned operator_options = DEFAULT_OPERATOR_OPTIONS;
+};
+
+// Known optimal digit counts, the 2016 row matches python/test.py.
+const RegressionCase regression_cases[] = {
+  { 0, 2016, 1, 9, 30, 9000 },
+  { 0, 2016, 2, 6, 5, 4000 },
+  { 0, 2016, 3, 4, 5, 4000 },
+  { 0, 2016, 4, 4, 5, 4000 },
+  { 0, 2016, 5, 6, 15, 6000 },
+  { 0, 2016, 6, 4, 5, 4000 },
+  { 0, 2016, 7, 6, 25, 8000 },
+  { 0, 2016, 8, 5, 5, 4000 },
+  { 0, 2016, 9, 4, 5, 5000 },
+  { 0, 2017, 3, 6, 90, 16000 },
+  { 0, 2017, 9, 5, 180, 23000 },
+  { 0, 1000, 4, 4, 5, 4000 },
+  { 0, 720, 3, 1, 5, 3000 },
+  { 0, 99, 9, 2, 5, 4000 },
+  { 0, 27, 6, 5, 5, 4000 },
+  { 0, 50, 8, 6, 10, 5000 },
+  // Seeds beyond 9 repeat as a whole in their literals.
+  { 0, 1234, 12, 7, 25, 11000 },
+  { 1, 2016, 3, 4, 5, 4000 },
+  { 1, 2016, 8, 5, 35, 10000 },
+  { 1, 1000, 5, 4, 5, 4000 },
+  { 1, 99, 3, 3, 5, 4000 },
+  { 1, 27, 6, 5, 5, 4000 },
+  // The double factorial shortens these, 945 = (3 * 3)‼.
+  { 0, 945, 3, 2, 5, 4000, DEFAULT_OPERATOR_OPTIONS | kDoubleFactorial },
+  { 0, 50, 8, 4, 5, 4500, DEFAULT_OPERATOR_OPTIONS | kDoubleFactorial },
+  { 0, 2017, 3, 5, 15, 8000, DEFAULT_OPERATOR_OPTIONS | kDoubleFactorial },
+  { 2, 27, 6, 4, 5, 4000 },
+  { 2, 50, 8, 5, 340, 53000 },
+  { 2, 2016, 9, 4, 705, 72000 },
+  { 2, 99, 9, 2, 5, 4000 },
+  { 2, 720, 6, 1, 5, 3000 },
+  // Auto cases escalate at their optimal digit count, so deeper results have to
+  // come out of the rebuilt generations.
+  { TchislaSolver::AUTO_SEARCH_MODE, 27, 6, 4, 15, 8200 },
+  { TchislaSolver::AUTO_SEARCH_MODE, 50, 8, 5, 560, 94000 },
+  { TchislaSolver::AUTO_SEARCH_MODE, 2016, 8, 5, 5, 4100 },
+};
+
+// Targets beyond the exhaustive search, split by TchislaPlanner over
+// generations built to PLAN_DEPTH. Planned digit counts are upper bounds, these
+// pin the plans found today so that a lost split fails.
+struct PlanCase {
+  int64_t target;
+  int64_t seed;
+  size_t digits;
+};
+
+constexpr int PLAN_DEPTH = 7;
+
+const PlanCase plan_cases[] = {
+  { 1234567890, 7, 15 },
+  { 123456, 8, 8 },
+};
+
+// With --check-envelopes a case also fails when it is slower than
+// TIME_TOLERANCE times its envelope plus TIME_SLACK_MS, or when its peak RSS
+// grows beyond MEMORY_TOLERANCE times its envelope plus MEMORY_SLACK_KB. The
+// envelopes only hold on machines like the one they were measured on, so only
+// digit counts and expressions are checked by default.
+constexpr double TIME_TOLERANCE = 2.0;
+constexpr long TIME_SLACK_MS = 50;
+constexpr double MEMORY_TOLERANCE = 1.25;
+constexpr long MEMORY_SLACK_KB = 2048;
+// The sort-merge engine crosses a whole generation before it expands the new
+// values, so cases found in the middle of a generation hold more of it.
+constexpr double SORT_MERGE_MEMORY_TOLERANCE = 2.0;
+
+// Evaluates a printed expression without any of the solver's Expr classes, so
+// a rendering or arithmetic bug in the solver cannot validate itself.
+class ExprEvaluator {
+public:
+  explicit ExprEvaluator(const string& text) : text_(text), pos_(0) { }
+
+  bool Evaluate(long double* value) {
+    if (!ParseBinary(value)) return false;
+    SkipSpaces();
+    return pos_ == text_.size();
+  }
+
+private:
+  const string& text_;
+  size_t pos_;
+
+  static constexpr const char* SQRT = "√";
+  static constexpr const char* DOUBLE_FACTORIAL = "‼";
+
+  void SkipSpaces() {
+    while (pos_ < text_.size() && text_[pos_] == ' ') ++pos_;
+  }
+
+  bool Consume(const char* token) {
+    SkipSpaces();
+    size_t len = strlen(token);
+    if (text_.compare(pos_, len, token) != 0) return false;
+    pos_ += len;
+    return true;
+  }
+
+  // The solver parenthesizes every binary operand, so an expression never holds
+  // more than one binary operator at the same nesting level.
+  bool ParseBinary(long double* value) {
+    long double left, right;
+    if (!ParseUnary(&left)) return false;
+    if (Consume("^-")) {
+      if (!ParseUnary(&right)) return false;
+      *value = 1 / powl(left, right);
+    } else if (Consume("^")) {
+      if (!ParseUnary(&right)) return false;
+      *value = powl(left, right);
+    } else if (Consume("+")) {
+      if (!ParseUnary(&right)) return false;
+      *value = left + right;
+    } else if (Consume("-")) {
+      if (!ParseUnary(&right)) return false;
+      *value = left - right;
+    } else if (Consume("*")) {
+      if (!ParseUnary(&right)) return false;
+      *value = left * right;
+    } else if (Consume("/")) {
+      if (!ParseUnary(&right)) return false;
+      *value = left / right;
+    } else {
+      *value = left;
+    }
+    return true;
+  }
+
+  bool ParseUnary(long double* value) {
+    if (Consume(SQRT)) {
+      if (!ParseUnary(value)) return false;
+      *value = sqrtl(*value);
+      return true;
+    }
+    return ParsePostfix(value);
+  }
+
+  // n‼ is the double factorial, n!! the factorial of n!.
+  bool ParsePostfix(long double* value) {
+    if (!ParsePrimary(value)) return false;
+    while (true) {
+      int step;
+      if (Consume(DOUBLE_FACTORIAL)) step = 2;
+      else if (Consume("!")) step = 1;
+      else return true;
+      long double n = roundl(*value);
+      if (fabsl(*value - n) > 1e-6 || n < 0 || n > 30 * step) return false;
+      *value = 1;
+      for (int i = n; i > 1; i -= step) *value *= i;
+    }
+  }
+
+  bool ParsePrimary(long double* value) {
+    if (Consume("(")) {
+      return ParseBinary(value) && Consume(")");
+    }
+    SkipSpaces();
+    size_t start = pos_;
+    while (pos_ < text_.size() && isdigit(static_cast<unsigned char>(text_[pos_]))) ++pos_;
+    if (start == pos_) return false;
+    *value = stold(text_.substr(start, pos_ - start));
+    return true;
+  }
+};
+
+// Every number in text has to be the seed repeated, each repeat is a digit.
+// Numbers that are not count as no digits at all, which fails the case.
+static size_t CountDigits(const string& text, int64_t seed) {
+  const string unit = to_string(seed);
+  size_t digits = 0;
+  for (size_t pos = 0; pos < text.size();) {
+    if (!isdigit(static_cast<unsigned char>(text[pos]))) {
+      ++pos;
+      continue;
+    }
+    size_t start = pos;
+    while (pos < text.size() && isdigit(static_cast<unsigned char>(text[pos]))) ++pos;
+    for (size_t i = start; i < pos; i += unit.size()) {
+      if (text.compare(i, unit.size(), unit) != 0 || i + unit.size() > pos) return 0;
+      ++digits;
+    }
+  }
+  return digits;
+}
+
+// Asks a solved solver about values no generation can hold, which must not
+// reach past the sets. Known values are only kept by the hash set engine.
+static bool CheckReachability(TchislaSolver::DedupEngine engine) {
+  TchislaSolver ts(2016, 2, 0);
+  ts.SetDedupEngine(engine);
+  if (!ts.Solve()) return false;
+  for (int64_t value : { int64_t(0), int64_t(-2), int64_t(-2016), INT64_MIN }) {
+    if (ts.IsReachable(value)) return false;
+  }
+  return engine == TchislaSolver::kSortMerge || ts.IsReachable(2);
+}
+
+// Checks that expression uses digits seeds and evaluates to target, empty
+// when it does.
+static string CheckExpression(const string& expression, int64_t target, int64_t seed, size_t digits) {
+  long double value;
+  if (CountDigits(expression, seed) != digits) {
+    return "expression uses " + to_string(CountDigits(expression, seed)) + " digits";
+  } else if (!ExprEvaluator(expression).Evaluate(&value)) {
+    return "cannot evaluate expression";
+  } else if (fabsl(value - target) > 1e-6L * target) {
+    return "expression evaluates to " + to_string(static_cast<double>(value));
+  }
+  return "";
+}
+
+// Writes text to a new temporary file and returns its path.
+static string WriteTemporary(const string& text) {
+  char path[] = "/tmp/tchisla-regression-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) return "";
+  close(fd);
+  ofstream(path) << text;
+  return path;
+}
+
+// Saves a profile with every limit changed and loads it back, then loads
+// profiles and corpora that are wrong and have to be refused with the line
+// at fault. Returns what went wrong, empty when nothing did.
+static string CheckProfiles() {
+  TchislaSolver::Config saved;
+  saved.value_max_limit = 1.5e12;
+  saved.value_min_limit = 3e-9;
+  saved.power_limit = 24;
+  saved.factorial_limit = 15;
+  saved.multi_threads_threshold = 2500;
+  saved.bitmap_limit = 1 << 16;
+  saved.precision = 1e-11;
+  string path = WriteTemporary("");
+  TchislaSolver::Config loaded;
+  string error;
+  bool round_trip = SaveProfile(path, saved) && LoadProfile(path, &loaded, &error);
+  remove(path.c_str());
+  if (!round_trip) return "profile round trip failed, " + error;
+  if (loaded.value_max_limit != saved.value_max_limit || loaded.value_min_limit != saved.value_min_limit ||
+      loaded.power_limit != saved.power_limit || loaded.factorial_limit != saved.factorial_limit ||
+      loaded.multi_threads_threshold != saved.multi_threads_threshold ||
+      loaded.bitmap_limit != saved.bitmap_limit || loaded.precision != saved.precision) {
+    return "profile round trip changed a limit";
+  }
+
+  // A profile may set a subset of the limits.
+  path = WriteTemporary("# partial\n\npower_limit = 32  # comment\n");
+  loaded = TchislaSolver::Config();
+  bool partial = LoadProfile(path, &loaded, &error);
+  remove(path.c_str());
+  if (!partial || loaded.power_limit != 32 || loaded.factorial_limit != TchislaSolver::Config().factorial_limit) {
+    return "partial profile not loaded, " + error;
+  }
+
+  const pair<const char*, bool (*)(const string&, string*)> refused[] = {
+    { "power_limit = 32\nunknown_limit = 3\n", [](const string& p, string* e) {
+      TchislaSolver::Config config;
+      return LoadProfile(p, &config, e);
+    } },
+    { "power_limit = 32\nfactorial_limit = many\n", [](const string& p, string* e) {
+      TchislaSolver::Config config;
+      return LoadProfile(p, &config, e);
+    } },
+    { "0 2016 1\n0 2016\n", [](const string& p, string* e) {
+      vector<CalibrationCase> corpus;
+      return LoadCalibrationCorpus(p, &corpus, e);
+    } },
+    { "0 2016 1\n3 2016 1\n", [](const string& p, string* e) {
+      vector<CalibrationCase> corpus;
+      return LoadCalibrationCorpus(p, &corpus, e);
+    } },
+  };
+  for (const auto& [text, load] : refused) {
+    path = WriteTemporary(text);
+    error.clear();
+    bool loaded_anyway = load(path, &error);
+    remove(path.c_str());
+    if (loaded_anyway || error.find(path + ":2:") != 0) {
+      return "\"" + string(text) + "\" not refused at line 2, " + error;
+    }
+  }
+
+  path = WriteTemporary("# cases\n0 2016 1\n\n-1 27 6  # auto\n");
+  vector<CalibrationCase> corpus;
+  bool read = LoadCalibrationCorpus(path, &corpus, &error);
+  remove(path.c_str());
+  if (!read || corpus.size() != 2 || corpus[1].search_mode != TchislaSolver::AUTO_SEARCH_MODE ||
+      corpus[1].target != 27 || corpus[1].seed != 6) {
+    return "corpus not loaded, " + error;
+  }
+  return "";
+}
+
+struct CaseResult {
+  bool found;
+  size_t digits;
+  long elapsed_ms;
+  char expression[1024];
+};
+
+// How every case is run.
+struct RunOptions {
+  TchislaSolver::DedupEngine engine = TchislaSolver::kHashSet;
+  bool value_only = false;
+  bool compress_generations = false;
+  // Generations stored before iterative deepening takes over, 0 to search
+  // breadth first only.
+  int deepening_depth = 0;
+};
+
+// Runs one case in a forked child so its peak RSS is not polluted by the
+// memory earlier cases left behind in the allocator.
+static bool RunCase(const RegressionCase& rc, const RunOptions& options,
+    CaseResult* result, long* peak_kb) {
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    close(fds[0]);
+    CaseResult child_result = {};
+    auto start = chrono::steady_clock::now();
+    TchislaSolver ts(rc.target, rc.seed, rc.search_mode);
+    if (rc.search_mode == TchislaSolver::AUTO_SEARCH_MODE) ts.SetEscalationDepth(rc.digits);
+    ts.SetOperatorOptions(rc.operator_options);
+    ts.SetDedupEngine(options.engine);
+    ts.SetValueOnly(options.value_only);
+    ts.SetCompressGenerations(options.compress_generations);
+    ts.SetIterativeDeepening(options.deepening_depth);
+    child_result.found = ts.Solve();
+    auto end = chrono::steady_clock::now();
+    child_result.elapsed_ms = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    if (child_result.found) {
+      child_result.digits = ts.Generations();
+      strncpy(child_result.expression, ts.Result().c_str(), sizeof(child_result.expression) - 1);
+    }
+    ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+    _exit(written == sizeof(child_result) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t received = read(fds[0], result, sizeof(*result));
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) return false;
+  *peak_kb = usage.ru_maxrss;
+  return received == sizeof(*result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Runs every case on its own thread of one process. Odd cases with the default
+// operators go through the C interface, which cannot change them, with a
+// config that keeps every integer in the hash set and crosses small
+// generations on several threads, neither of which changes a result, so that
+// concurrent solvers with different configs have to stay independent.
+static void RunConcurrently(const RunOptions& options, vector<CaseResult>* results) {
+  constexpr size_t num_cases = sizeof(regression_cases) / sizeof(regression_cases[0]);
+  results->assign(num_cases, CaseResult{});
+  vector<thread> threads;
+  for (size_t i = 0; i < num_cases; ++i) {
+    threads.emplace_back([&options, results, i]() {
+      const RegressionCase& rc = regression_cases[i];
+      CaseResult& result = (*results)[i];
+      auto start = chrono::steady_clock::now();
+      if (i % 2 == 0 || rc.operator_options != DEFAULT_OPERATOR_OPTIONS) {
+        TchislaSolver ts(rc.target, rc.seed, rc.search_mode);
+        if (rc.search_mode == TchislaSolver::AUTO_SEARCH_MODE) ts.SetEscalationDepth(rc.digits);
+        ts.SetOperatorOptions(rc.operator_options);
+        ts.SetDedupEngine(options.engine);
+        ts.SetValueOnly(options.value_only);
+        ts.SetCompressGenerations(options.compress_generations);
+        result.found = ts.Solve();
+        if (result.found) {
+          result.digits = ts.Generations();
+          strncpy(result.expression, ts.Result().c_str(), sizeof(result.expression) - 1);
+        }
+      } else {
+        tchisla_config config;
+        tchisla_config_init(&config);
+        config.bitmap_limit = 0;
+        config.multi_threads_threshold = 100;
+        tchisla_solver* solver = tchisla_create(&config, rc.target, rc.seed, rc.search_mode);
+        if (solver != nullptr && rc.search_mode == TchislaSolver::AUTO_SEARCH_MODE) {
+          tchisla_set_escalation_depth(solver, rc.digits);
+        }
+        result.found = solver != nullptr && tchisla_solve(solver, 20) == TCHISLA_FOUND;
+        if (result.found) {
+          result.digits = tchisla_digits(solver);
+          tchisla_result(solver, result.expression, sizeof(result.expression));
+        }
+        tchisla_destroy(solver);
+      }
+      auto end = chrono::steady_clock::now();
+      result.elapsed_ms = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    });
+  }
+  for (auto& t : threads) t.join();
+}
+
+// Operator options as the cases spell them, relative to the defaults.
+static string FormatOperatorOptions(unsigned options) {
+  static const pair<unsigned, const char*> flags[] = {
+    { kMultiSqrtPower, "kMultiSqrtPower" },
+    { kDoubleFactorial, "kDoubleFactorial" },
+  };
+  string removed, added;
+  for (const auto& [flag, name] : flags) {
+    bool enabled = (options & flag) != 0;
+    bool by_default = (DEFAULT_OPERATOR_OPTIONS & flag) != 0;
+    if (enabled && !by_default) added += string(" | ") + name;
+    if (!enabled && by_default) removed += string(" & ~") + name;
+  }
+  string text = "DEFAULT_OPERATOR_OPTIONS" + removed;
+  if (!removed.empty() && !added.empty()) text = "(" + text + ")";
+  return text + added;
+}
+
+int main(int argc, char* argv[]) {
+  // With --check-envelopes the time and memory envelopes are checked too, with
+  // --update the measured envelopes are printed instead. With --sort-merge
+  // every case runs with the sort-merge dedup engine, with --value-only every
+  // case reconstructs its result from values, with --compress-generations too
+  // from compressed generations. With --iterative-deepening every case stores
+  // four generations and deepens from there, which is exact for all of them.
+  // With --concurrent all cases run at once in one process, see
+  // RunConcurrently(). Both of these ignore --check-envelopes.
+  bool update = false;
+  bool check_envelopes = false;
+  bool concurrent = false;
+  RunOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (string(argv[i]) == "--update") update = true;
+    if (string(argv[i]) == "--check-envelopes") check_envelopes = true;
+    if (string(argv[i]) == "--sort-merge") options.engine = TchislaSolver::kSortMerge;
+    if (string(argv[i]) == "--value-only") options.value_only = true;
+    if (string(argv[i]) == "--compress-generations") options.compress_generations = true;
+    if (string(argv[i]) == "--iterative-deepening") options.deepening_depth = 4;
+    if (string(argv[i]) == "--concurrent") concurrent = true;
+  }
+  double memory_tolerance =
+    options.engine == TchislaSolver::kSortMerge ? SORT_MERGE_MEMORY_TOLERANCE : MEMORY_TOLERANCE;
+  size_t failures = 0;
+  if (!CheckReachability(options.engine)) {
+    cout << "FAILED, reachability of values outside the generations" << endl;
+    ++failures;
+  }
+  string profile_error = CheckProfiles();
+  if (!profile_error.empty()) {
+    cout << "FAILED, " << profile_error << endl;
+    ++failures;
+  }
+  vector<CaseResult> concurrent_results;
+  if (concurrent) RunConcurrently(options, &concurrent_results);
+
+  for (size_t i = 0; i < sizeof(regression_cases) / sizeof(regression_cases[0]); ++i) {
+    const RegressionCase& rc = regression_cases[i];
+    CaseResult result;
+    long peak_kb = 0;
+    cout << "Mode " << rc.search_mode << ", " << rc.target << " with " << rc.seed << ": ";
+    if (concurrent) {
+      result = concurrent_results[i];
+    } else if (!RunCase(rc, options, &result, &peak_kb)) {
+      cout << "FAILED, solver process did not finish" << endl;
+      ++failures;
+      continue;
+    }
+
+    string error;
+    string expression = result.expression;
+    if (!result.found) {
+      error = "not found";
+    } else if (result.digits != rc.digits) {
+      error = "expected " + to_string(rc.digits) + " digits, got " + to_string(result.digits);
+    } else {
+      error = CheckExpression(expression, rc.target, rc.seed, rc.digits);
+    }
+    // Envelopes do not hold while every case shares the cores, and were
+    // measured for breadth first searches.
+    bool envelopes_apply = error.empty() && check_envelopes && !update && !concurrent &&
+      options.deepening_depth == 0;
+    if (envelopes_apply && result.elapsed_ms > rc.envelope_ms * TIME_TOLERANCE + TIME_SLACK_MS) {
+      error = "took " + to_string(result.elapsed_ms) + "ms, envelope " + to_string(rc.envelope_ms) + "ms";
+    } else if (envelopes_apply && peak_kb > rc.envelope_kb * memory_tolerance + MEMORY_SLACK_KB) {
+      error = "peak RSS " + to_string(peak_kb) + "KB, envelope " + to_string(rc.envelope_kb) + "KB";
+    }
+
+    cout << result.elapsed_ms << "ms, " << peak_kb << "KB, " << expression;
+    if (!error.empty()) {
+      cout << "\n  FAILED, " << error;
+      ++failures;
+    }
+    if (update) {
+      cout << "\n  { " << rc.search_mode << ", " << rc.target << ", " << rc.seed << ", "
+        << rc.digits << ", " << result.elapsed_ms << ", " << peak_kb;
+      if (rc.operator_options != DEFAULT_OPERATOR_OPTIONS) {
+        cout << ", " << FormatOperatorOptions(rc.operator_options);
+      }
+      cout << " },";
+    }
+    cout << endl;
+  }
+
+  // Plans are checked the same way, without envelopes.
+  for (const PlanCase& pc : plan_cases) {
+    cout << "Plan, " << pc.target << " with " << pc.seed << ": ";
+    TchislaPlanner planner(TchislaSolver::Config(), pc.target, pc.seed, 0, PLAN_DEPTH);
+    planner.Cache().SetDedupEngine(options.engine);
+    planner.Cache().SetValueOnly(options.value_only);
+    string error;
+    if (!planner.Plan()) {
+      error = "not found";
+    } else if (planner.Digits() != pc.digits) {
+      error = "expected " + to_string(pc.digits) + " digits, got " + to_string(planner.Digits());
+    } else {
+      error = CheckExpression(planner.Result(), pc.target, pc.seed, pc.digits);
+    }
+    cout << planner.Result();
+    if (!error.empty()) {
+      cout << "\n  FAILED, " << error;
+      ++failures;
+    }
+    cout << endl;
+  }
+
+  cout << (failures == 0 ? "All regression cases passed" : to_string(failures) + " regression cases failed") << endl;
+  return failures == 0 ? 0 : 1;
+}
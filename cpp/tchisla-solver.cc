@@ -1,93 +1,1317 @@
 ﻿#include "tchisla-solver.h"
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
 #include <sstream>
 #include <thread>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
 
 using std::ostringstream;
+using std::string;
 using std::thread;
 using std::vector;
 
 #define RETURN_IF_TRUE(expr) if (expr) return true
 
-double TchislaSolver::VALUE_MAX_LIMIT = 1e15;
-double TchislaSolver::VALUE_MIN_LIMIT = 1e-8;
-int64_t TchislaSolver::POWER_LIMIT = 40;
-int64_t TchislaSolver::FACTORIAL_LIMIT = 20;
-size_t TchislaSolver::MUILT_THREADS_THRESHOLD = 10000;
+
+// Operators enabled by each search mode and set of operator options, Solve()
+// picks one of them once and every loop below is compiled separately for it.
+template<int SearchMode, unsigned Options>
+struct TchislaSolver::Strategy {
+  // Mode 0 drops non-integers above the target, deeper modes keep them.
+  static constexpr int SEARCH_MODE = SearchMode;
+  static constexpr bool PRUNE_BIG_NON_INTEGERS = SearchMode == 0;
+  static constexpr RootPolicy ROOTS =
+    SearchMode == 0 ? RootPolicy::kIntegers : SearchMode == 1 ? RootPolicy::kSeed : RootPolicy::kAll;
+  // Applied in this order to every pair of members, and to every new member.
+  using BinaryOperators = typename ConcatOperators<
+    OperatorList<AdditionOperator, SubtractionOperator, MultiplicationOperator>,
+    OperatorsIf<(SearchMode > 1), SqrtMultiplicationOperator>,
+    OperatorList<DivisionOperator, PowerOperator>,
+    OperatorsIf<(SearchMode > 0), NegativePowerOperator>,
+    OperatorsIf<(Options & kMultiSqrtPower) != 0, MultiSqrtPowerOperator<(SearchMode > 0)>>>::type;
+  using UnaryOperators = typename ConcatOperators<
+    OperatorList<FactorialOperator>,
+    OperatorsIf<(Options & kDoubleFactorial) != 0, DoubleFactorialOperator>,
+    OperatorList<SquareRootOperator<ROOTS>>,
+    OperatorsIf<(SearchMode > 0), DoubleSquareRootOperator<ROOTS>>>::type;
+  static constexpr bool STREAM_CANDIDATES = false;
+  static constexpr bool STAGE_CANDIDATES = false;
+  static constexpr bool SORT_CANDIDATES = false;
+  static constexpr bool BEAM_CANDIDATES = false;
+  static constexpr bool DELTA_CANDIDATES = false;
+  template<class Op> static constexpr bool SKIPS = false;
+  // Mode the generations were built with and the strategy without delta filter,
+  // only differ from this strategy while escalating.
+  using Base = Strategy;
+  using Full = Strategy;
+};
+
+// Candidates of a streamed generation are checked against the target and
+// expanded, but neither deduplicated nor stored.
+template<class S>
+struct TchislaSolver::Streaming : S {
+  static constexpr bool STREAM_CANDIDATES = true;
+  using Full = Streaming<typename S::Full>;
+};
+
+// Candidates of a staged generation are collected per worker and only merged
+// into the shared set once every worker has finished crossing.
+template<class S>
+struct TchislaSolver::Staged : S {
+  static constexpr bool STAGE_CANDIDATES = true;
+  using Full = Staged<typename S::Full>;
+};
+
+// Candidates of a sorted generation are only recorded with their provenance
+// per worker, and deduplicated in bulk once the records are sorted.
+template<class S>
+struct TchislaSolver::Sorted : S {
+  static constexpr bool SORT_CANDIDATES = true;
+  using Full = Sorted<typename S::Full>;
+};
+
+// Candidates of a beam generation are only recorded with their provenance and
+// score, the best of them are built once every pair is crossed.
+template<class S>
+struct TchislaSolver::Beam : S {
+  static constexpr bool BEAM_CANDIDATES = true;
+  using Full = Beam<typename S::Full>;
+};
+
+// Crosses pairs of members that both come from generations of the From mode.
+// From already produced every value of its own operators that it did not prune,
+// so only candidates of the operators To adds and those From pruned are kept.
+template<class From, class To>
+struct TchislaSolver::Escalation : To {
+  static constexpr bool DELTA_CANDIDATES = true;
+  // Unless From pruned some of their values, its own operators are skipped.
+  template<class Op> static constexpr bool SKIPS =
+    !(From::PRUNE_BIG_NON_INTEGERS && !To::PRUNE_BIG_NON_INTEGERS) &&
+    (From::BinaryOperators::template CONTAINS<Op> || From::UnaryOperators::template CONTAINS<Op>);
+  using Base = From;
+  using Full = To;
+};
+
+// Number of candidate pairs crossed between two budget checks.
+static constexpr size_t BUDGET_CHECK_INTERVAL = 4 * 1024;
+
+// How many staged values ahead the merge loop prefetches set buckets.
+static constexpr size_t MERGE_PREFETCH_DISTANCE = 8;
+
+// How far a generation forecast may be off, see AdmitGeneration().
+static constexpr double FORECAST_MARGIN = 2;
+// Bounds of the forecast exponents, steeper fits come from small generations
+// whose costs are mostly noise.
+static constexpr double MAX_MEMBERS_EXPONENT = 1.25;
+static constexpr double MAX_SECONDS_EXPONENT = 1.5;
+
+static string FormatBytes(size_t bytes) {
+  ostringstream ss;
+  ss.precision(3);
+  if (bytes < 1024 * 1024) ss << bytes / 1024.0 << "KB";
+  else if (bytes < 1024 * 1024 * 1024) ss << bytes / (1024.0 * 1024) << "MB";
+  else ss << bytes / (1024.0 * 1024 * 1024) << "GB";
+  return ss.str();
+}
+
+void MemoryUsage::MergeMax(const MemoryUsage& other) {
+  expr_pools = std::max(expr_pools, other.expr_pools);
+  generations = std::max(generations, other.generations);
+  reachable_values = std::max(reachable_values, other.reachable_values);
+  staging = std::max(staging, other.staging);
+}
+
+string MemoryUsage::ToString() const {
+  ostringstream ss;
+  ss << FormatBytes(Total()) << " (pools " << FormatBytes(expr_pools)
+    << ", generations " << FormatBytes(generations)
+    << ", reachable values " << FormatBytes(reachable_values)
+    << ", staging " << FormatBytes(staging) << ')';
+  return ss.str();
+}
+
+string SolveStatus::ToString() const {
+  ostringstream ss;
+  switch (code) {
+  case kNotFound: ss << "not found"; break;
+  case kFound: ss << "found"; break;
+  case kDeadlineExceeded: ss << "deadline exceeded"; break;
+  case kCancelled: ss << "cancelled"; break;
+  case kCandidateLimitExceeded: ss << "candidate limit exceeded"; break;
+  case kMemoryLimitExceeded:
+    ss << "memory limit exceeded, using " << FormatBytes(peak_total_memory);
+    break;
+  }
+  ss << " after " << completed_generations << " generations, "
+    << num_candidates << " candidates";
+  return ss.str();
+}
 
 TchislaSolver::TchislaSolver(int64_t target, int64_t seed, int search_mode, std::ostream* trace_os)
-  : target_(target), seed_(seed), search_mode_(search_mode), trace_os_(trace_os),
-  reachable_values_(Expr::DOUBLE_PRECISION) {
-  expr_pools_.emplace_back(new ObjectPool<OBJ_POOL_SIZE>);
-  creators_.emplace_back(*this, 0);
+  : TchislaSolver(Config(), target, seed, search_mode, trace_os) {
+}
+
+TchislaSolver::TchislaSolver(const Config& config, int64_t target, int64_t seed, int search_mode,
+    std::ostream* trace_os)
+  : config_(config), target_(target), seed_(seed), search_mode_(search_mode), trace_os_(trace_os),
+  reachable_values_(config.precision, config.bitmap_limit) {
+  AddCreator();
+}
+
+std::string TchislaSolver::Result() const {
+  std::lock_guard<std::mutex> lock(result_mutex_);
+  return result_;
+}
+
+void TchislaSolver::SetTimeline(Timeline* timeline) {
+  timeline_ = timeline;
+  for (auto& creator : creators_) {
+    creator.timeline_buffer = timeline_->NewBuffer(
+        "Seed " + std::to_string(seed_) + " worker " + std::to_string(creator.part_id));
+  }
+}
+
+void TchislaSolver::AddCreator() {
+  size_t part_id = creators_.size();
+  if (part_id == expr_pools_.size()) {
+    expr_pools_.emplace_back(new ObjectPool<OBJ_POOL_SIZE>);
+  }
+  creators_.emplace_back(*this, part_id);
+  perf_counts_.emplace_back();
+  if (timeline_ != nullptr) {
+    creators_.back().timeline_buffer = timeline_->NewBuffer(
+        "Seed " + std::to_string(seed_) + " worker " + std::to_string(part_id));
+  }
 }
 
 bool TchislaSolver::Solve(int search_depth) {
-  while (search_depth-- > 0) {
-    size_t num_loops = (generations_.size() + 1) / 2;
-    if (UseMultiThread()) {
-      MultiThreadCrossGeneration(num_loops);
-      RETURN_IF_TRUE(found.load());
-    } else {
-      NewGeneration(1);
-      for (size_t i = 0; i < num_loops; ++i) {
-        const GenerationPtr& g1 = generations_[i];
-        const GenerationPtr& g2 = generations_[generations_.size() - i - 1];
-        RETURN_IF_TRUE(creators_[0].CrossGeneration(g1, g2));
+  // The calling thread records as worker 0.
+  Timeline::Binding binding(creators_[0].timeline_buffer);
+  Value::PrecisionBinding precision(config_.precision);
+  if (UseDeepening()) {
+    return SolveDeepening(search_depth);
+  }
+  if (search_mode_ != AUTO_SEARCH_MODE) {
+    return SolveInMode(search_mode_, search_depth, true);
+  }
+  return SolveEscalating(search_depth);
+}
+
+bool TchislaSolver::BuildGenerations(int search_depth) {
+  Timeline::Binding binding(creators_[0].timeline_buffer);
+  Value::PrecisionBinding precision(config_.precision);
+  return SolveInMode(search_mode_ != AUTO_SEARCH_MODE ? search_mode_ : active_mode_, search_depth, false);
+}
+
+// Cheaper modes only search up to the escalation depth and keep their last
+// generation, so that the next mode can extend it.
+bool TchislaSolver::SolveEscalating(int search_depth) {
+  while (true) {
+    int depth = std::min(search_depth, escalation_depth_ - static_cast<int>(generations_.size()));
+    if (depth > 0) {
+      search_depth -= depth;
+      if (SolveInMode(active_mode_, depth, false) || status_.Stopped()) {
+        return status_.code == SolveStatus::kFound;
+      }
+    }
+    if (active_mode_ == 2) break;
+    bool stopped = DispatchOperators(operator_options_, [this](auto options) {
+      constexpr unsigned O = decltype(options)::value;
+      return active_mode_ == 0 ?
+        Escalate<Strategy<0, O>, Strategy<1, O>>() : Escalate<Strategy<1, O>, Strategy<2, O>>();
+    });
+    ++active_mode_;
+    if (stopped) {
+      UpdateStatus();
+      return status_.code == SolveStatus::kFound;
+    }
+  }
+  return SolveInMode(active_mode_, search_depth, true);
+}
+
+// Calls solve with the operator options as a compile-time constant.
+template<class F>
+bool TchislaSolver::DispatchOperators(unsigned options, const F& solve) {
+  using std::integral_constant;
+  switch (options & (kMultiSqrtPower | kDoubleFactorial)) {
+  case 0: return solve(integral_constant<unsigned, 0>());
+  case kMultiSqrtPower: return solve(integral_constant<unsigned, kMultiSqrtPower>());
+  case kDoubleFactorial: return solve(integral_constant<unsigned, kDoubleFactorial>());
+  default: return solve(integral_constant<unsigned, kMultiSqrtPower | kDoubleFactorial>());
+  }
+}
+
+bool TchislaSolver::SolveInMode(int search_mode, int search_depth, bool stream_last) {
+  return DispatchOperators(operator_options_, [&](auto options) {
+    constexpr unsigned O = decltype(options)::value;
+    switch (search_mode) {
+    case 0: return SolveWith<Strategy<0, O>>(search_depth, stream_last);
+    case 1: return SolveWith<Strategy<1, O>>(search_depth, stream_last);
+    default: return SolveWith<Strategy<2, O>>(search_depth, stream_last);
+    }
+  });
+}
+
+template<class S>
+bool TchislaSolver::SolveWith(int search_depth, bool stream_last) {
+  while (!exhausted_ && search_depth-- > 0 && !CheckBudget()) {
+    Timeline::Scope scope("generation", "level", generations_.size() + 1);
+    size_t pairs = NumPairs();
+    auto start = Clock::now();
+    size_t bytes = GetMemoryUsage().Total();
+    if (!AdmitGeneration(ForecastGeneration(), stream_last && search_depth == 0)) break;
+    if (stream_last && search_depth == 0) {
+      // The last requested generation is never crossed with anything, so it is
+      // only streamed through the target check and the dedup set is released.
+      // The bitmap of small integers is kept for IsReachable().
+      reachable_values_.ClearSets();
+      sorted_values_.Clear();
+      exhausted_ = true;
+      if (NextGeneration<Streaming<S>>()) break;
+      if (trace_os_ != nullptr) {
+        *trace_os_ << "Seed: " << seed_
+          << ", G" << generations_.size() + 1 << " streamed" << std::endl;
+        TracePerfCounts();
       }
+    } else {
+      if (NextGeneration<S>()) break;
+      EndGeneration();
+      generation_costs_.push_back({ pairs, GenerationSize(generations_.size() - 1),
+        std::chrono::duration<double>(Clock::now() - start).count(), GetMemoryUsage().Total() - bytes });
+      if (UseCompression()) CompressGeneration();
     }
-    RETURN_IF_TRUE(creators_[0].AddLiteral(generations_.size() + 1));
+  }
+  UpdateStatus();
+  if (trace_os_ != nullptr) {
+    size_t num_values = std::max<size_t>(status_.num_candidates, 1);
+    *trace_os_ << "Seed: " << seed_
+      << ", peak memory: " << status_.peak_memory.ToString()
+      << ", " << status_.peak_total_memory / num_values << " bytes per reachable value" << std::endl;
+  }
+  return status_.code == SolveStatus::kFound;
+}
+
+// Pairs of members the cross loops of the next generation go through.
+size_t TchislaSolver::NumPairs() const {
+  size_t pairs = 0;
+  for (size_t i = 0; i < (generations_.size() + 1) / 2; ++i) {
+    pairs += GenerationSize(i) * GenerationSize(generations_.size() - i - 1);
+  }
+  return pairs;
+}
+
+// Exponent of the power law through (x0, y0) and (x1, y1), within [low, high].
+static double FitExponent(double x0, double y0, double x1, double y1, double low, double high) {
+  if (x0 <= 0 || y0 <= 0 || x1 <= x0 || y1 <= 0) return low;
+  return std::clamp(std::log(y1 / y0) / std::log(x1 / x0), low, high);
+}
+
+// Extrapolates the cost of the next generation from the last two, with powers
+// of the crossed pairs fitted through both. Members grow slower than the pairs
+// as more of them are duplicates, time grows faster as the sets outgrow the
+// caches. Bytes per member are taken as they were in the last one.
+TchislaSolver::GenerationForecast TchislaSolver::ForecastGeneration() const {
+  GenerationForecast forecast;
+  size_t n = generation_costs_.size();
+  if (n < 2 || UseBeam()) return forecast;
+  const GenerationCost& last = generation_costs_[n - 1];
+  const GenerationCost& before = generation_costs_[n - 2];
+  if (last.pairs == 0 || last.members == 0) return forecast;
+  forecast.pairs = NumPairs();
+  double growth = static_cast<double>(forecast.pairs) / last.pairs;
+  forecast.members = static_cast<size_t>(last.members * std::pow(growth,
+    FitExponent(before.pairs, before.members, last.pairs, last.members, 0, MAX_MEMBERS_EXPONENT)));
+  forecast.seconds = last.seconds * std::pow(growth,
+    FitExponent(before.pairs, before.seconds, last.pairs, last.seconds, 1, MAX_SECONDS_EXPONENT));
+  forecast.bytes = static_cast<size_t>(static_cast<double>(last.bytes) / last.members * forecast.members);
+  return forecast;
+}
+
+// Refuses a generation that would exceed a budget by more than the forecast
+// can be off, the search would only stop inside it with the same status.
+// Otherwise the hash sets may be grown for the forecast members up front.
+bool TchislaSolver::AdmitGeneration(const GenerationForecast& forecast, bool streamed) {
+  if (forecast.pairs == 0) return true;
+  if (trace_os_ != nullptr) {
+    *trace_os_ << "Seed: " << seed_ << ", G" << generations_.size() + 1 << " forecast: "
+      << forecast.pairs << " pairs, " << forecast.members << " members, "
+      << forecast.seconds << "s, " << FormatBytes(forecast.bytes) << std::endl;
+  }
+  SolveStatus::Code refused = SolveStatus::kNotFound;
+  const char* budget = nullptr;
+  auto seconds_left = std::chrono::duration<double>(deadline_ - Clock::now()).count();
+  if (deadline_ != Clock::time_point::max() && forecast.seconds > FORECAST_MARGIN * seconds_left) {
+    refused = SolveStatus::kDeadlineExceeded;
+    budget = "deadline";
+  } else if (!streamed && max_candidates_ != SIZE_MAX &&
+      num_candidates_.load() + forecast.members / FORECAST_MARGIN > max_candidates_) {
+    refused = SolveStatus::kCandidateLimitExceeded;
+    budget = "candidate limit";
+  } else if (!streamed && memory_limit_ != SIZE_MAX &&
+      SampleMemoryUsage() + forecast.bytes / FORECAST_MARGIN > memory_limit_) {
+    refused = SolveStatus::kMemoryLimitExceeded;
+    budget = "memory limit";
+  }
+  if (refused != SolveStatus::kNotFound) {
+    if (trace_os_ != nullptr) {
+      *trace_os_ << "Seed: " << seed_ << ", G" << generations_.size() + 1
+        << " not started, forecast exceeds the " << budget << std::endl;
+    }
+    Stop(refused);
+    return false;
+  }
+  if (presize_sets_ && !streamed && !UseSortMerge()) {
+    size_t num_values = 0;
+    for (size_t level = 0; level < generations_.size(); ++level) num_values += GenerationSize(level);
+    reachable_values_.Reserve(1 + static_cast<double>(forecast.members) / std::max<size_t>(num_values, 1));
+  }
+  return true;
+}
+
+// Rebuilds the generations of the From mode as if they had been searched with
+// To. Every level is rebuilt in order from the members From kept at it plus the
+// candidates To adds, which gives the same values per level as a fresh search.
+template<class From, class To>
+bool TchislaSolver::Escalate() {
+  Timeline::Scope scope("escalate", "mode", To::SEARCH_MODE);
+  escalated_ = std::move(generations_);
+  generations_.clear();
+  generation_costs_.clear();
+  kept_.clear();
+  kept_.resize(escalated_.size());
+  reachable_values_.Clear();
+  while (generations_.size() < escalated_.size() && !CheckBudget()) {
+    Timeline::Scope level_scope("generation", "level", generations_.size() + 1);
+    if (NextGeneration<Escalation<From, To>>()) break;
     EndGeneration();
   }
-  return false;
+  for (size_t level = 0; level < generations_.size(); ++level) {
+    for (const Expr* expr : *kept_[level]) {
+      generations_[level]->push_back(0, expr);
+    }
+  }
+  escalated_.clear();
+  kept_.clear();
+  if (trace_os_ != nullptr && !stop_.load()) {
+    *trace_os_ << "Seed: " << seed_ << ", escalated "
+      << generations_.size() << " generations to mode " << To::SEARCH_MODE << std::endl;
+  }
+  return stop_.load();
+}
+
+bool TchislaSolver::UseDeepening() const {
+  return deepening_depth_ > 0 && search_mode_ != AUTO_SEARCH_MODE && !UseBeam();
+}
+
+bool TchislaSolver::SolveDeepening(int search_depth) {
+  int depth = std::min(search_depth, deepening_depth_) - static_cast<int>(generations_.size());
+  if (SolveInMode(search_mode_, std::max(depth, 0), false) || status_.Stopped() || exhausted_) {
+    return status_.code == SolveStatus::kFound;
+  }
+  return DispatchOperators(operator_options_, [&](auto options) {
+    constexpr unsigned O = decltype(options)::value;
+    switch (search_mode_) {
+    case 0: return DeepenWith<Strategy<0, O>>(search_depth);
+    case 1: return DeepenWith<Strategy<1, O>>(search_depth);
+    default: return DeepenWith<Strategy<2, O>>(search_depth);
+    }
+  });
+}
+
+// Tries every digit budget beyond the stored generations in turn, so the first
+// budget that reaches the target is the fewest digits as long as the search of
+// every smaller one was complete.
+template<class S>
+bool TchislaSolver::DeepenWith(int search_depth) {
+  Deepening<S> deepening(*this);
+  for (size_t budget = generations_.size() + 1; budget <= static_cast<size_t>(search_depth); ++budget) {
+    Timeline::Scope scope("deepen", "digits", budget);
+    const Expr* expr = deepening.Find(Value(target_), budget);
+    if (expr != nullptr) {
+      deepened_digits_ = budget;
+      PublishResult<S>(expr);
+      break;
+    }
+    if (deepening.aborted || CheckBudget()) break;
+    if (trace_os_ != nullptr) {
+      *trace_os_ << "Seed: " << seed_ << ", no result with " << budget << " digits, "
+        << deepening.num_nodes << " sub-targets searched" << std::endl;
+    }
+  }
+  // Sampled while the transposition table is still held.
+  UpdateStatus();
+  if (trace_os_ != nullptr) {
+    *trace_os_ << "Seed: " << seed_ << ", peak memory: " << status_.peak_memory.ToString() << std::endl;
+  }
+  return status_.code == SolveStatus::kFound;
+}
+
+template<class S>
+bool TchislaSolver::NextGeneration() {
+  PerfCounters::Scope counters(PerfCountsOf(0));
+  size_t num_loops = (generations_.size() + 1) / 2;
+  if constexpr (!S::STREAM_CANDIDATES && !S::DELTA_CANDIDATES) {
+    if (UseBeam()) {
+      BeamGeneration<S>(num_loops);
+      return stop_.load() || creators_[0].AddLiteral<S>(generations_.size() + 1);
+    }
+    if (UseSortMerge()) {
+      SortMergeGeneration<S>(num_loops);
+      return stop_.load();
+    }
+  }
+  if (UseMultiThread()) {
+    MultiThreadCrossGeneration<S>(num_loops);
+  } else {
+    NewGeneration(1);
+    if constexpr (S::DELTA_CANDIDATES) {
+      RETURN_IF_TRUE(creators_[0].AddKept<typename S::Full>(generations_.size()));
+    }
+    for (size_t i = 0; i < num_loops && !stop_.load(); ++i) {
+      creators_[0].CrossPair<S>(i);
+    }
+  }
+  return stop_.load() || creators_[0].AddLiteral<S>(generations_.size() + 1);
+}
+
+bool TchislaSolver::Stop(SolveStatus::Code code) {
+  int running = SolveStatus::kNotFound;
+  bool first = stop_code_.compare_exchange_strong(running, code);
+  stop_.store(true);
+  return first;
+}
+
+bool TchislaSolver::CheckBudget() {
+  if (stop_.load()) return true;
+  if (cancel_token_ != nullptr && cancel_token_->load()) {
+    Stop(SolveStatus::kCancelled);
+  } else if (num_candidates_.load() > max_candidates_) {
+    Stop(SolveStatus::kCandidateLimitExceeded);
+  } else if (deadline_ != Clock::time_point::max() && Clock::now() > deadline_) {
+    Stop(SolveStatus::kDeadlineExceeded);
+  } else if (memory_limit_ != SIZE_MAX && SampleMemoryUsage() > memory_limit_) {
+    Stop(SolveStatus::kMemoryLimitExceeded);
+  }
+  return stop_.load();
+}
+
+MemoryUsage TchislaSolver::GetMemoryUsage() const {
+  MemoryUsage usage;
+  for (const auto& pool : expr_pools_) {
+    usage.expr_pools += pool->AllocatedBytes();
+  }
+  for (const auto& generation : generations_) {
+    usage.generations += generation->AllocatedBytes();
+  }
+  for (const auto& generation : cold_generations_) {
+    usage.generations += generation->AllocatedBytes();
+  }
+  for (const auto& generation : escalated_) {
+    if (generation) usage.generations += generation->AllocatedBytes();
+  }
+  for (const auto& generation : kept_) {
+    if (generation) usage.generations += generation->AllocatedBytes();
+  }
+  if (current_generation_) {
+    usage.generations += current_generation_->AllocatedBytes();
+  }
+  usage.reachable_values = reachable_values_.AllocatedBytes() + sorted_values_.AllocatedBytes();
+  usage.staging = staging_bytes_.load();
+  return usage;
+}
+
+size_t TchislaSolver::SampleMemoryUsage() {
+  size_t total = GetMemoryUsage().Total();
+  size_t peak = peak_total_memory_.load();
+  while (peak < total && !peak_total_memory_.compare_exchange_weak(peak, total)) { }
+  return total;
+}
+
+MemoryUsage TchislaSolver::UpdateMemoryPeaks() {
+  MemoryUsage usage = GetMemoryUsage();
+  status_.peak_memory.MergeMax(usage);
+  size_t peak = peak_total_memory_.load();
+  while (peak < usage.Total() && !peak_total_memory_.compare_exchange_weak(peak, usage.Total())) { }
+  return usage;
+}
+
+void TchislaSolver::UpdateStatus() {
+  for (auto& creator : creators_) {
+    num_candidates_ += creator.num_new_candidates;
+    creator.num_new_candidates = 0;
+  }
+  status_.code = static_cast<SolveStatus::Code>(stop_code_.load());
+  status_.completed_generations = generations_.size();
+  status_.generation_sizes.clear();
+  for (size_t level = 0; level < generations_.size(); ++level) {
+    status_.generation_sizes.push_back(GenerationSize(level));
+  }
+  status_.num_candidates = num_candidates_.load();
+  status_.optimal = !UseBeam() && deepened_digits_ <= 2 * generations_.size() + 1;
+  UpdateMemoryPeaks();
+  status_.peak_total_memory = peak_total_memory_.load();
+}
+
+size_t TchislaSolver::GenerationSize(size_t level) const {
+  if (level < cold_generations_.size()) return cold_generations_[level]->size();
+  return generations_[level]->size();
+}
+
+size_t TchislaSolver::LastGenerationSize() const {
+  size_t size = GenerationSize(generations_.size() - 1);
+  if (generations_.size() <= kept_.size()) {
+    size += kept_[generations_.size() - 1]->size();
+  }
+  return size;
 }
 
 bool TchislaSolver::UseMultiThread() const {
-  return !generations_.empty() && generations_.back()->size() > MUILT_THREADS_THRESHOLD;
+  return !generations_.empty() && LastGenerationSize() > config_.multi_threads_threshold;
 }
 
+template<class S>
 void TchislaSolver::MultiThreadCrossGeneration(size_t num_loops) {
-  vector<thread> extra_threads;
-  size_t num_extra_threads = num_loops - 1;
-  size_t part_id = creators_.back().part_id;
-  while (num_extra_threads > expr_pools_.size() - 1) {
-    expr_pools_.emplace_back(new ObjectPool<OBJ_POOL_SIZE>);
-  }
-  while (num_extra_threads > creators_.size() - 1) {
-    creators_.emplace_back(*this, ++part_id);
+  while (creators_.size() < num_loops) {
+    AddCreator();
   }
   NewGeneration(num_loops);
-  for (size_t i = 0; i < num_loops - 1; ++i) {
-    const GenerationPtr* g1 = &generations_[i];
-    const GenerationPtr* g2 = &generations_[generations_.size() - i - 1];
-    GenerationCreator* thread_creator = &creators_[i + 1];
-    extra_threads.emplace_back([=]() { thread_creator->CrossGeneration(*g1, *g2); });
-  }
-  const GenerationPtr& g1 = generations_[num_loops - 1];
-  const GenerationPtr& g2 = generations_[generations_.size() - num_loops];
-  creators_[0].CrossGeneration(g1, g2);
+  if constexpr (S::DELTA_CANDIDATES) {
+    // Kept members go into the set before any worker reads it.
+    if (creators_[0].AddKept<typename S::Full>(generations_.size())) return;
+  }
+  auto cross = [this](size_t worker, auto strategy) {
+    creators_[worker].CrossPair<decltype(strategy)>(worker);
+  };
+  if constexpr (S::STREAM_CANDIDATES) {
+    RunWorkers(num_loops, [&](size_t worker) { cross(worker, S()); });
+    return;
+  }
+
+  // Workers only read the shared set while crossing and stage their new values
+  // locally. The staged values are then merged partition by partition, each set
+  // of reachable_values_ by a single worker, so the merge needs no locks. Values
+  // merged in a round are expanded through factorial and square root into the
+  // next round, all within the same generation.
+  RunWorkers(num_loops, [&](size_t worker) {
+    cross(worker, Staged<S>());
+    Timeline::Scope scope("flush");
+    creators_[worker].num_staged = creators_[worker].staging.Flush();
+  });
+  auto has_staged = [&]() {
+    for (size_t i = 0; i < num_loops; ++i) {
+      if (creators_[i].num_staged > 0) return true;
+    }
+    return false;
+  };
+  while (!stop_.load() && has_staged()) {
+    RunWorkers(num_loops, [&](size_t worker) { creators_[worker].MergeStaged(worker, num_loops); });
+    RunWorkers(num_loops, [&](size_t worker) {
+      GenerationCreator& creator = creators_[worker];
+      creator.ExpandMerged<typename Staged<S>::Full>();
+      Timeline::Scope scope("flush");
+      creator.num_staged = creator.staging.Flush();
+    });
+  }
+  for (size_t i = 0; i < num_loops; ++i) {
+    creators_[i].staging.Release();
+    creators_[i].num_staged = 0;
+  }
+}
+
+bool TchislaSolver::UseBeam() const {
+  return beam_width_ > 0 && search_mode_ != AUTO_SEARCH_MODE;
+}
+
+// Lower is better: the distance of value to target in log space, less the log
+// of the factor they share, so that multiples and divisors of the target rank
+// above values that are only close to it.
+static double BeamScore(const Value& value, int64_t target) {
+  double score = std::abs(std::log(value.GetDouble() / static_cast<double>(target)));
+  if (value.IsInt()) score -= std::log(static_cast<double>(std::gcd(value.GetIntUnsafe(), target)));
+  return score;
+}
+
+// Crosses every pair on a single worker, which only keeps the provenance of the
+// best candidates. They are built in order of their scores, and expanded through
+// the unary operators without any limit, as are the literals. A generation thus
+// holds at most a few times the beam width of members.
+template<class S>
+void TchislaSolver::BeamGeneration(size_t num_loops) {
+  NewGeneration(1);
+  GenerationCreator& creator = creators_[0];
+  creator.beam.SetWidth(beam_width_);
+  for (size_t i = 0; i < num_loops && !stop_.load(); ++i) {
+    creator.CrossPair<Beam<S>>(i);
+  }
+  if (!stop_.load()) creator.ExpandBeam<S>();
+}
+
+bool TchislaSolver::UseSortMerge() const {
+  return dedup_engine_ == kSortMerge && search_mode_ != AUTO_SEARCH_MODE;
+}
+
+// Workers cross their share of pairs without touching any set and record each
+// candidate as its value and provenance. Every worker radix sorts its records,
+// then MergeSorted() joins all of them with the sorted reachable values in one
+// sequential pass per group. The winners are expanded through the unary
+// operators into the next round, as with staged generations.
+template<class S>
+void TchislaSolver::SortMergeGeneration(size_t num_loops) {
+  size_t num_workers = UseMultiThread() ? num_loops : 1;
+  while (creators_.size() < num_workers) {
+    AddCreator();
+  }
+  NewGeneration(num_workers);
+  RunWorkers(num_workers, [&](size_t worker) {
+    GenerationCreator& creator = creators_[worker];
+    for (size_t i = worker; i < num_loops && !stop_.load(); i += num_workers) {
+      creator.CrossPair<Sorted<S>>(i);
+    }
+    if (worker == 0 && !stop_.load()) creator.AddLiteral<Sorted<S>>(generations_.size() + 1);
+    Timeline::Scope scope("sort");
+    creator.num_sorted = creator.sorting.Sort();
+  });
+  auto has_sorted = [&]() {
+    for (size_t i = 0; i < num_workers; ++i) {
+      if (creators_[i].num_sorted > 0) return true;
+    }
+    return false;
+  };
+  while (!stop_.load() && has_sorted()) {
+    MergeSorted(num_workers);
+    RunWorkers(num_workers, [&](size_t worker) {
+      GenerationCreator& creator = creators_[worker];
+      creator.ExpandMerged<typename Sorted<S>::Full>();
+      Timeline::Scope scope("sort");
+      creator.num_sorted = creator.sorting.Sort();
+    });
+  }
+  for (size_t i = 0; i < num_workers; ++i) {
+    creators_[i].sorting.Release();
+    creators_[i].num_sorted = 0;
+  }
+}
+
+// The first record of every value that is not reachable yet wins, it is built
+// in the pool of the worker that recorded it and queued for its expansion.
+void TchislaSolver::MergeSorted(size_t num_workers) {
+  Timeline::Scope scope("merge join");
+  using Entry = GenerationCreator::SortingRecords::Entry;
+  vector<const Entry*> heads(num_workers);
+  vector<const Entry*> ends(num_workers);
+  for (size_t group = 0; group < ReachableSet::NUM_GROUPS; ++group) {
+    for (size_t i = 0; i < num_workers; ++i) {
+      const auto& sorted = creators_[i].sorting.Sorted(group);
+      heads[i] = sorted.data();
+      ends[i] = sorted.data() + sorted.size();
+    }
+    const auto& reachable = sorted_values_.Group(group);
+    auto next_reachable = reachable.begin();
+    auto merged_values = sorted_values_.NewValues();
+    merged_values.reserve(reachable.size());
+    while (true) {
+      size_t first = num_workers;
+      for (size_t i = 0; i < num_workers; ++i) {
+        if (heads[i] != ends[i] && (first == num_workers || heads[i]->value < heads[first]->value)) first = i;
+      }
+      if (first == num_workers) break;
+      int64_t value = heads[first]->value;
+      while (next_reachable != reachable.end() && *next_reachable < value) {
+        merged_values.push_back(*next_reachable++);
+      }
+      if (next_reachable == reachable.end() || *next_reachable != value) {
+        GenerationCreator& creator = creators_[first];
+        const auto& provenance = heads[first]->payload;
+        const Expr* expr = provenance.build != nullptr ? provenance.build(creator, provenance) : provenance.child;
+        current_generation_->push_back(first, expr);
+        creator.merged.push_back(expr);
+        ++creator.num_new_candidates;
+        merged_values.push_back(value);
+      }
+      for (size_t i = 0; i < num_workers; ++i) {
+        while (heads[i] != ends[i] && heads[i]->value == value) ++heads[i];
+      }
+    }
+    merged_values.insert(merged_values.end(), next_reachable, reachable.end());
+    sorted_values_.Replace(group, std::move(merged_values));
+  }
+}
+
+template<class F>
+void TchislaSolver::RunWorkers(size_t num_workers, const F& work) {
+  vector<thread> extra_threads;
+  for (size_t worker = 1; worker < num_workers; ++worker) {
+    extra_threads.emplace_back([this, &work, worker]() {
+      Timeline::Binding binding(creators_[worker].timeline_buffer);
+      Value::PrecisionBinding precision(config_.precision);
+      PerfCounters::Scope counters(PerfCountsOf(worker));
+      work(worker);
+    });
+  }
+  work(0);
+  Timeline::Scope scope("join", "threads", extra_threads.size());
   for (auto& t : extra_threads) {
     t.join();
   }
 }
 
+TchislaSolver::ReachableSet::Key TchislaSolver::MakeKey(const Value& value) const {
+  if (value.IsInt()) {
+    return reachable_values_.MakeKey(value.GetIntUnsafe());
+  } else {
+    return reachable_values_.MakeKey(value.GetDoubleUnsafe());
+  }
+}
+
+bool TchislaSolver::UseValueOnly() const {
+  return value_only_ && search_mode_ != AUTO_SEARCH_MODE;
+}
+
+bool TchislaSolver::UseCompression() const {
+  return compress_generations_ && UseValueOnly() && !UseSortMerge() && !UseBeam() && !UseDeepening();
+}
+
+// Replaces the generation just built by its compressed values. Every stored
+// generation is compressed once it is built, so nothing points into the
+// expression pools any more and they are cleared.
+void TchislaSolver::CompressGeneration() {
+  Timeline::Scope scope("compress", "level", generations_.size());
+  GenerationPtr& generation = generations_.back();
+  cold_generations_.push_back(std::make_unique<ColdGeneration>(*generation));
+  generation = std::make_unique<PartitionedList<const Expr*>>(1);
+  for (auto& pool : expr_pools_) pool->Clear();
+  if (trace_os_ != nullptr) {
+    *trace_os_ << "Seed: " << seed_ << ", G" << generations_.size() << " compressed to "
+      << FormatBytes(cold_generations_.back()->AllocatedBytes()) << std::endl;
+  }
+}
+
+// Derives expressions for the members of a value-only search from the values of
+// the generations built so far. The generation a value lies in gives its digit
+// count. It is the literal of that many digits, a binary operator of members of
+// two generations whose digit counts add up to it, or a unary operator of a
+// member of the same generation, tried in the order the search makes them. Of
+// the two generations of a binary operator only the smaller is enumerated, the
+// other operand is solved for with the inverse operator and looked up among the
+// nearest values. Every match is verified by building the expression, so it has
+// exactly the value of the member. Members are told apart by their values, which
+// no two of them share, since those of compressed generations are decoded into
+// copies.
+template<class BinaryOperators, class UnaryOperators>
+struct TchislaSolver::Reconstruction : ValueExpr::Resolver {
+  TchislaSolver& solver;
+  const OperatorContext& context;
+  // Members of every generation in the order they were found, and sorted by value.
+  vector<vector<const Expr*>> generations;
+  vector<vector<const Expr*>> sorted;
+  ObjectPool<OBJ_POOL_SIZE> pool;
+  // Keyed by the values of the members.
+  std::unordered_map<double, const Expr*> resolved;
+  // Members on the current derivation path, unary operators within a generation
+  // must not lead back to them.
+  std::unordered_set<double> resolving;
+
+  explicit Reconstruction(TchislaSolver& solver) : solver(solver), context(solver.creators_[0].context) {
+    auto add_generation = [&](PartitionedList<const Expr*>& members) {
+      generations.emplace_back();
+      for (const Expr* member : members) generations.back().push_back(member);
+      sorted.push_back(generations.back());
+      std::sort(sorted.back().begin(), sorted.back().end(), [](const Expr* a, const Expr* b) {
+        return a->GetDouble() < b->GetDouble();
+      });
+    };
+    for (size_t level = 0; level < solver.generations_.size(); ++level) {
+      if (level < solver.cold_generations_.size()) {
+        PartitionedList<const Expr*> members(1);
+        ColdGeneration::Reader reader(*solver.cold_generations_[level]);
+        while (const auto* block = reader.NextBlock()) {
+          for (const ValueExpr& member : *block) members.push_back(0, Build<ValueExpr>(member));
+        }
+        add_generation(members);
+      } else {
+        add_generation(*solver.generations_[level]);
+      }
+    }
+    if (solver.current_generation_) add_generation(*solver.current_generation_);
+  }
+
+  const Expr* Resolve(const ValueExpr& member) override {
+    auto it = resolved.find(member.GetDouble());
+    if (it != resolved.end()) return it->second;
+    if (!resolving.insert(member.GetDouble()).second) return nullptr;
+    const Expr* expr = nullptr;
+    for (size_t level = 0; level < generations.size() && expr == nullptr; ++level) {
+      if (Holds(level, &member)) expr = Derive(member, level);
+    }
+    resolving.erase(member.GetDouble());
+    if (expr != nullptr) resolved.emplace(member.GetDouble(), expr);
+    return expr;
+  }
+
+  bool Holds(size_t level, const Expr* member) const {
+    const auto& values = sorted[level];
+    auto it = std::lower_bound(values.begin(), values.end(), member->GetDouble(),
+        [](const Expr* a, double value) { return a->GetDouble() < value; });
+    return it != values.end() && (*it)->GetDouble() == member->GetDouble();
+  }
+
+  // Calls f with the members of level nearest to value until it returns true.
+  template<class F>
+  bool ForNearest(size_t level, double value, const F& f) const {
+    if (!std::isfinite(value)) return false;
+    const auto& values = sorted[level];
+    auto it = std::lower_bound(values.begin(), values.end(), value,
+        [](const Expr* a, double value) { return a->GetDouble() < value; });
+    if (it != values.end() && f(*it)) return true;
+    return it != values.begin() && f(*(it - 1));
+  }
+
+  // A member itself when it is not a ValueExpr, as the literals of sort-merge.
+  const Expr* Real(const Expr* operand) {
+    if (typeid(*operand) != typeid(ValueExpr)) return operand;
+    return Resolve(static_cast<const ValueExpr&>(*operand));
+  }
+
+  template<class T, class... Args>
+  const Expr* Build(Args&&... args) {
+    const Expr* expr = pool.EmplaceObject<T>(std::forward<Args>(args)...);
+    pool.CommitLastObject();
+    return expr;
+  }
+
+  // Builds T from the members if it has the value of target, and from their
+  // derivations if they have any.
+  template<class T, class... Args, class... Operands>
+  const Expr* TryBuild(const Expr& target, Args... args, const Operands*... operands) {
+    const Expr* expr = pool.EmplaceObject<T>(args..., operands...);
+    auto key = solver.MakeKey(*expr), target_key = solver.MakeKey(target);
+    if (key.set_id != target_key.set_id || key.value != target_key.value) return nullptr;
+    std::array<const Expr*, sizeof...(Operands)> real = { Real(operands)... };
+    for (const Expr* operand : real) {
+      if (operand == nullptr) return nullptr;
+    }
+    return std::apply([&](auto... real) { return Build<T>(args..., real...); }, real);
+  }
+
+  const Expr* Derive(const Expr& member, size_t level) {
+    size_t digits = level + 1;
+    if (member.IsInt()) {
+      string literal;
+      for (size_t i = 0; i < digits; ++i) literal += std::to_string(solver.seed_);
+      if (literal.size() < 19 && stoll(literal) == member.GetIntUnsafe()) return Build<LiteralExpr>(std::move(literal));
+    }
+    const Expr* expr = nullptr;
+    for (size_t small = 0; expr == nullptr && 2 * (small + 1) <= digits; ++small) {
+      size_t large = digits - (small + 1) - 1;
+      for (const Expr* operand : generations[small]) {
+        BinaryOperators::Any([&](auto* op) {
+          expr = DeriveBinary<std::remove_pointer_t<decltype(op)>>(member, operand, large);
+          return expr != nullptr;
+        });
+        if (expr != nullptr) break;
+      }
+    }
+    if (expr == nullptr) {
+      UnaryOperators::Any([&](auto* op) {
+        using Op = std::remove_pointer_t<decltype(op)>;
+        return ForNearest(level, Op::SolveOperand(member.GetDouble()), [&](const Expr* operand) {
+          if (operand->GetDouble() == member.GetDouble() || !Op::Admits(*operand, context)) return false;
+          expr = TryBuild<typename Op::ExprType>(member, operand);
+          return expr != nullptr;
+        });
+      });
+    }
+    return expr;
+  }
+
+  // The binary operator Op of operand and a member of level with the value of
+  // target, operand on either side.
+  template<class Op>
+  const Expr* DeriveBinary(const Expr& target, const Expr* operand, size_t level) {
+    using T = typename Op::ExprType;
+    const Expr* expr = nullptr;
+    auto try_pair = [&](auto tag, const Expr* left, const Expr* right, auto... sqrt_times) {
+      using U = typename decltype(tag)::type;
+      if (!Op::Admits(*left, *right, context)) return false;
+      expr = TryBuild<U, decltype(sqrt_times)...>(target, sqrt_times..., left, right);
+      return expr != nullptr;
+    };
+    if constexpr (std::is_constructible_v<T, int, const Expr*, const Expr*>) {
+      // Both powers of the repeated square roots, whose exponent has to be
+      // divisible by 2 ^ sqrt_times.
+      auto try_powers = [&](auto tag, double result) {
+        for (int sqrt_times = 1; sqrt_times < 63; ++sqrt_times) {
+          auto divisible = [&](const Expr* exponent) {
+            return exponent->IsInt() && exponent->GetIntUnsafe() > 0 &&
+              __builtin_ctzll(exponent->GetIntUnsafe()) >= sqrt_times;
+          };
+          if (divisible(operand) && ForNearest(level, Op::SolveLeft(sqrt_times, result, operand->GetDouble()),
+              [&](const Expr* base) { return try_pair(tag, base, operand, sqrt_times); })) return true;
+          if (ForNearest(level, Op::SolveRight(sqrt_times, result, operand->GetDouble()),
+              [&](const Expr* exponent) {
+                return divisible(exponent) && try_pair(tag, operand, exponent, sqrt_times);
+              })) return true;
+        }
+        return false;
+      };
+      if (!try_powers(std::common_type<MultiSqrtPowExpr>(), target.GetDouble())) {
+        try_powers(std::common_type<NegMultiSqrtPowExpr>(), 1 / target.GetDouble());
+      }
+    } else {
+      std::common_type<T> tag;
+      ForNearest(level, Op::SolveRight(target.GetDouble(), operand->GetDouble()),
+          [&](const Expr* right) { return try_pair(tag, operand, right); }) ||
+      ForNearest(level, Op::SolveLeft(target.GetDouble(), operand->GetDouble()),
+          [&](const Expr* left) { return try_pair(tag, left, operand); });
+    }
+    return expr;
+  }
+};
+
+// Binds a reconstruction of the stored generations while a value-only result
+// is rendered. Concurrent workers only write the current generation in phases
+// in which the target cannot be found, so it can be read here.
+template<class S>
+string TchislaSolver::Render(const Expr* expr) {
+  if (!UseValueOnly()) return expr->ToString();
+  Timeline::Scope scope("reconstruct");
+  Reconstruction<typename S::BinaryOperators, typename S::UnaryOperators> reconstruction(*this);
+  ValueExpr::Binding binding(&reconstruction);
+  return expr->ToString();
+}
+
+template<class S>
+void TchislaSolver::PublishResult(const Expr* expr) {
+  if (!Stop(SolveStatus::kFound)) return;
+  std::string result = Render<S>(expr);
+  std::lock_guard<std::mutex> lock(result_mutex_);
+  result_ = std::move(result);
+}
+
+// Searches the digit counts beyond the stored generations top down. A value
+// has an expression of at most budget digits if it is
+//   a stored member of at most budget digits,
+//   the literal of budget digits,
+//   a binary operator of a member of a stored generation of a digits, with a
+//   <= budget / 2, and a value of at most budget - a digits, or
+//   a unary operator of a value of at most budget digits.
+// The other operand comes from the inverse of the operator, and every candidate
+// is built and compared by key with the admission rules of the breadth-first
+// search, so both find the same digit counts. Sub-targets that fail at a budget
+// are remembered in a bounded transposition table. The search is complete while
+// one side of every split fits the stored generations, that is up to twice
+// their number of digits plus one.
+template<class S>
+struct TchislaSolver::Deepening {
+  using BinaryOperators = typename S::BinaryOperators;
+  using UnaryOperators = typename S::UnaryOperators;
+  // Bounds the unary operators applied in a row within one budget.
+  static constexpr int MAX_UNARY_CHAIN = 8;
+  static constexpr size_t TABLE_SLOTS = 1 << 20;
+  static constexpr size_t BUDGET_CHECK_INTERVAL = 4096;
+
+  struct Member {
+    double value;
+    const Expr* expr;
+    size_t digits;
+  };
+
+  TchislaSolver& solver;
+  const OperatorContext& context;
+  // Members of every stored generation in the order they were found, and all of
+  // them sorted by value.
+  vector<vector<const Expr*>> generations;
+  vector<Member> sorted;
+  ObjectPool<OBJ_POOL_SIZE> pool;
+  // The largest budget each sub-target is known to fail at.
+  TranspositionTable<size_t> failed;
+  size_t num_nodes = 0;
+  bool aborted = false;
+
+  explicit Deepening(TchislaSolver& solver)
+    : solver(solver), context(solver.creators_[0].context), failed(TABLE_SLOTS, &solver.staging_bytes_) {
+    for (auto& generation : solver.generations_) {
+      generations.emplace_back();
+      for (const Expr* member : *generation) {
+        generations.back().push_back(member);
+        sorted.push_back({ member->GetDouble(), member, generations.size() });
+      }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Member& a, const Member& b) { return a.value < b.value; });
+  }
+
+  // An expression of value with at most budget digits, null if there is none or
+  // a budget of the solver ran out.
+  const Expr* Find(const Value& value, size_t budget, int unary_chain = 0) {
+    if (aborted) return nullptr;
+    auto key = solver.MakeKey(value);
+    if (const Expr* member = Stored(value, key, budget)) return member;
+    if (budget <= generations.size()) return nullptr;
+    size_t failed_budget;
+    if (failed.Find(key.set_id, key.value, &failed_budget) && failed_budget >= budget) return nullptr;
+    if (++num_nodes % BUDGET_CHECK_INTERVAL == 0 && solver.CheckBudget()) {
+      aborted = true;
+      return nullptr;
+    }
+    const Expr* expr = Derive(value, key, budget, unary_chain);
+    if (expr == nullptr && !aborted) failed.Store(key.set_id, key.value, budget);
+    return expr;
+  }
+
+  // Find() for an operand, which has to pass the value limits of a candidate.
+  const Expr* FindOperand(double operand, size_t budget, int unary_chain = 0) {
+    if (!std::isfinite(operand)) return nullptr;
+    Value value(operand);
+    if (operand < solver.config_.value_min_limit || operand > solver.config_.value_max_limit) return nullptr;
+    if (S::PRUNE_BIG_NON_INTEGERS && !value.IsInt() && operand > solver.target_) return nullptr;
+    return Find(value, budget, unary_chain);
+  }
+
+  const Expr* Stored(const Value& value, const ReachableSet::Key& key, size_t budget) const {
+    auto it = std::lower_bound(sorted.begin(), sorted.end(), value.GetDouble(),
+        [](const Member& member, double value) { return member.value < value; });
+    auto matches = [&](const Member& member) {
+      auto member_key = solver.MakeKey(*member.expr);
+      return member.digits <= budget && member_key.set_id == key.set_id && member_key.value == key.value;
+    };
+    if (it != sorted.end() && matches(*it)) return it->expr;
+    if (it != sorted.begin() && matches(*(it - 1))) return (it - 1)->expr;
+    return nullptr;
+  }
+
+  // Builds T from args if it has the key and keeps tells so.
+  template<class T, class Keeps, class... Args>
+  const Expr* TryBuild(const ReachableSet::Key& key, const Keeps& keeps, Args... args) {
+    const Expr* expr = pool.EmplaceObject<T>(std::move(args)...);
+    auto expr_key = solver.MakeKey(*expr);
+    if (expr_key.set_id != key.set_id || expr_key.value != key.value || !keeps(*expr)) return nullptr;
+    pool.CommitLastObject();
+    return expr;
+  }
+
+  const Expr* Derive(const Value& value, const ReachableSet::Key& key, size_t budget, int unary_chain) {
+    if (value.IsInt()) {
+      string literal;
+      for (size_t i = 0; i < budget && literal.size() < 19; ++i) literal += std::to_string(solver.seed_);
+      if (literal.size() < 19 && stoll(literal) == value.GetIntUnsafe()) {
+        return TryBuild<LiteralExpr>(key, [](const Expr&) { return true; }, literal);
+      }
+    }
+    const Expr* expr = nullptr;
+    for (size_t digits = 1; digits <= generations.size() && 2 * digits <= budget; ++digits) {
+      for (const Expr* operand : generations[digits - 1]) {
+        BinaryOperators::Any([&](auto* op) {
+          expr = DeriveBinary<std::remove_pointer_t<decltype(op)>>(value, key, operand, budget - digits);
+          return expr != nullptr || aborted;
+        });
+        if (expr != nullptr || aborted) return expr;
+      }
+    }
+    if (unary_chain < MAX_UNARY_CHAIN) {
+      UnaryOperators::Any([&](auto* op) {
+        using Op = std::remove_pointer_t<decltype(op)>;
+        const Expr* operand = FindOperand(Op::SolveOperand(value.GetDouble()), budget, unary_chain + 1);
+        if (operand != nullptr && Op::Admits(*operand, context)) {
+          expr = TryBuild<typename Op::ExprType>(key,
+              [&](const Expr& result) { return Op::Keeps(result, *operand, context); }, operand);
+        }
+        return expr != nullptr || aborted;
+      });
+    }
+    return expr;
+  }
+
+  // The binary operator Op of operand and a value of at most budget digits,
+  // operand on either side.
+  template<class Op>
+  const Expr* DeriveBinary(const Value& value, const ReachableSet::Key& key, const Expr* operand, size_t budget) {
+    using T = typename Op::ExprType;
+    const Expr* expr = nullptr;
+    auto try_pair = [&](auto tag, const Expr* left, const Expr* right, auto... sqrt_times) {
+      using U = typename decltype(tag)::type;
+      if (left == nullptr || right == nullptr || !Op::Admits(*left, *right, context)) return false;
+      // Reciprocal powers of repeated square roots are kept unconditionally.
+      expr = TryBuild<U>(key, [&](const Expr& result) {
+        return std::is_same_v<U, NegMultiSqrtPowExpr> || Op::Keeps(result, *left, *right, context);
+      }, sqrt_times..., left, right);
+      return expr != nullptr;
+    };
+    if constexpr (std::is_constructible_v<T, int, const Expr*, const Expr*>) {
+      // The exponent has to be divisible by 2 ^ sqrt_times, which bounds the
+      // square root counts of a given exponent.
+      auto divisible = [](const Value& exponent, int sqrt_times) {
+        return exponent.IsInt() && exponent.GetIntUnsafe() > 0 &&
+          __builtin_ctzll(exponent.GetIntUnsafe()) >= sqrt_times;
+      };
+      auto try_powers = [&](auto tag, double result) {
+        for (int sqrt_times = 1; sqrt_times < 63 && !aborted; ++sqrt_times) {
+          if (divisible(*operand, sqrt_times) &&
+              try_pair(tag, FindOperand(Op::SolveLeft(sqrt_times, result, operand->GetDouble()), budget),
+                operand, sqrt_times)) return true;
+          double exponent = Op::SolveRight(sqrt_times, result, operand->GetDouble());
+          if (std::isfinite(exponent) && divisible(Value(exponent), sqrt_times) &&
+              try_pair(tag, operand, FindOperand(exponent, budget), sqrt_times)) return true;
+        }
+        return false;
+      };
+      if (!try_powers(std::common_type<MultiSqrtPowExpr>(), value.GetDouble())) {
+        try_powers(std::common_type<NegMultiSqrtPowExpr>(), 1 / value.GetDouble());
+      }
+    } else {
+      std::common_type<T> tag;
+      if (try_pair(tag, operand, FindOperand(Op::SolveRight(value.GetDouble(), operand->GetDouble()), budget))) {
+        return expr;
+      }
+      if (!Op::COMMUTATIVE && !aborted) {
+        try_pair(tag, FindOperand(Op::SolveLeft(value.GetDouble(), operand->GetDouble()), budget), operand);
+      }
+    }
+    return expr;
+  }
+};
+
+bool TchislaSolver::IsReachable(int64_t value) const {
+  // Generations only hold positive values, and the key of any other one would
+  // pick a set that does not exist.
+  if (value <= 0) return false;
+  if (UseSortMerge()) {
+    const auto& values = sorted_values_.Group(0);
+    return std::binary_search(values.begin(), values.end(), value);
+  }
+  return reachable_values_.Contains(reachable_values_.MakeKey(value));
+}
+
 bool TchislaSolver::AddReachableValueIfNotExist(const Expr& expr) {
-  if (expr.IsInt()) {
-    return reachable_values_.InsertIfNotExist(expr.GetIntUnsafe());
+  return reachable_values_.InsertIfNotExist(MakeKey(expr));
+}
+
+void TchislaSolver::GenerationCreator::MergeStaged(size_t first_set_id, size_t num_workers) {
+  Timeline::Scope scope("merge");
+  ReachableSet& reachable_values = solver.reachable_values_;
+  for (size_t set_id = first_set_id; set_id < ReachableSet::NUM_SETS; set_id += num_workers) {
+    for (size_t i = 0; i < num_workers; ++i) {
+      const auto& staging = solver.creators_[i].staging;
+      const auto* end = staging.PartitionEnd(set_id);
+      for (const auto* entry = staging.PartitionBegin(set_id); entry != end; ++entry) {
+        if (static_cast<size_t>(end - entry) > MERGE_PREFETCH_DISTANCE) {
+          reachable_values.Prefetch({ set_id, entry[MERGE_PREFETCH_DISTANCE].value });
+        }
+        if (reachable_values.InsertUnlocked({ set_id, entry->value })) {
+          solver.current_generation_->push_back(part_id, entry->payload);
+          merged.push_back(entry->payload);
+          ++num_new_candidates;
+        }
+      }
+    }
+  }
+}
+
+template<class S>
+bool TchislaSolver::GenerationCreator::ExpandBeam() {
+  Timeline::Scope scope("expand", "values", beam.size());
+  bool found = false;
+  beam.Drain([&](const auto& entry) {
+    if (found || !solver.reachable_values_.InsertIfNotExist({ entry.key.first, entry.key.second })) return;
+    const Provenance& provenance = entry.payload;
+    const Expr* expr = provenance.build != nullptr ? provenance.build(*this, provenance) : provenance.child;
+    solver.current_generation_->push_back(part_id, expr);
+    ++num_new_candidates;
+    found = Expand<S>(expr);
+  });
+  return found;
+}
+
+template<class S>
+bool TchislaSolver::GenerationCreator::ExpandMerged() {
+  Timeline::Scope scope("expand", "values", merged.size());
+  for (const Expr* expr : merged) {
+    if (Expand<S>(expr)) break;
+  }
+  merged.clear();
+  return solver.stop_.load();
+}
+
+// Keeps the records of a worker from growing with every duplicate candidate.
+// The reachable values are only rewritten between the rounds of a generation,
+// so they can be read here without locks.
+void TchislaSolver::GenerationCreator::CompactSorting(size_t group) {
+  Timeline::Scope scope("compact");
+  const auto& reachable = solver.sorted_values_.Group(group);
+  auto next_reachable = reachable.begin();
+  sorting.Compact(group, [&](int64_t value) {
+    next_reachable = std::lower_bound(next_reachable, reachable.end(), value);
+    return next_reachable != reachable.end() && *next_reachable == value;
+  });
+}
+
+bool TchislaSolver::GenerationCreator::CheckBudget() {
+  solver.num_candidates_ += num_new_candidates;
+  num_new_candidates = 0;
+  return solver.CheckBudget();
+}
+
+template<class S>
+bool TchislaSolver::GenerationCreator::CrossPair(size_t index) {
+  Timeline::Scope scope("cross", "pair", index + 1);
+  const auto& generations = solver.generations_;
+  size_t other = generations.size() - index - 1;
+  if constexpr (S::DELTA_CANDIDATES) {
+    // Pairs with a member only the deeper mode reached are crossed in full.
+    using Full = typename S::Full;
+    const auto& kept = solver.kept_;
+    RETURN_IF_TRUE(CrossGeneration<S>(kept[index], kept[other]));
+    RETURN_IF_TRUE(CrossGeneration<Full>(kept[index], generations[other]));
+    if (index != other) {
+      RETURN_IF_TRUE(CrossGeneration<Full>(generations[index], kept[other]));
+    }
+    return CrossGeneration<Full>(generations[index], generations[other]);
   } else {
-    return reachable_values_.InsertIfNotExist(expr.GetDoubleUnsafe());
+    const auto& cold = solver.cold_generations_;
+    if (other < cold.size()) return CrossColdGeneration<S>(*cold[index], *cold[other]);
+    return CrossGeneration<S>(generations[index], generations[other]);
   }
 }
 
+template<class S>
 bool TchislaSolver::GenerationCreator::CrossGeneration(
     const GenerationPtr& g1, const GenerationPtr& g2) {
+  size_t budget_countdown = BUDGET_CHECK_INTERVAL;
   for (const auto& expr1 : *g1) {
     for (const auto& expr2 : *g2) {
-      RETURN_IF_TRUE(AddAddition(expr1, expr2));
-      RETURN_IF_TRUE(AddSubtraction(expr1, expr2));
-      RETURN_IF_TRUE(AddMultiplication(expr1, expr2));
-      RETURN_IF_TRUE(AddDivision(expr1, expr2));
-      RETURN_IF_TRUE(AddPower(expr1, expr2));
+      if (--budget_countdown == 0) {
+        RETURN_IF_TRUE(CheckBudget());
+        budget_countdown = BUDGET_CHECK_INTERVAL;
+      }
+      RETURN_IF_TRUE(S::BinaryOperators::template Apply<S>(*this, expr1, expr2));
+    }
+  }
+  return false;
+}
+
+// Streams both generations through a block of decoded members each, in the
+// same nested order as CrossGeneration().
+template<class S>
+bool TchislaSolver::GenerationCreator::CrossColdGeneration(
+    const ColdGeneration& g1, const ColdGeneration& g2) {
+  size_t budget_countdown = BUDGET_CHECK_INTERVAL;
+  ColdGeneration::Reader reader1(g1);
+  ColdGeneration::Reader reader2(g2);
+  while (const auto* block1 = reader1.NextBlock()) {
+    for (const ValueExpr& expr1 : *block1) {
+      reader2.Rewind();
+      while (const auto* block2 = reader2.NextBlock()) {
+        for (const ValueExpr& expr2 : *block2) {
+          if (--budget_countdown == 0) {
+            RETURN_IF_TRUE(CheckBudget());
+            budget_countdown = BUDGET_CHECK_INTERVAL;
+          }
+          RETURN_IF_TRUE(S::BinaryOperators::template Apply<S>(*this, &expr1, &expr2));
+        }
+      }
     }
   }
   return false;
@@ -99,129 +1323,181 @@ void TchislaSolver::NewGeneration(size_t num_new_parts) {
 
 
 void TchislaSolver::EndGeneration() {
+  MemoryUsage usage = UpdateMemoryPeaks();
   if (trace_os_ != nullptr) {
+    size_t size = current_generation_->size();
+    if (generations_.size() < kept_.size()) {
+      size += kept_[generations_.size()]->size();
+    }
     *trace_os_ << "Seed: " << seed_
       << ", G" << generations_.size() + 1
-      << " size: " << current_generation_->size() << std::endl;
+      << " size: " << size
+      << ", memory: " << usage.ToString() << std::endl;
+    TracePerfCounts();
   }
   generations_.push_back(std::move(current_generation_));
 }
 
-bool TchislaSolver::GenerationCreator::AddCandidate(const Expr* expr) {
-  RETURN_IF_TRUE(solver.found.load());
+// Prints and resets what every worker counted for the generation just built,
+// the number of the generation is that of the last trace line.
+void TchislaSolver::TracePerfCounts() {
+  if (!perf_counters_) return;
+  bool counted = false;
+  for (size_t worker = 0; worker < perf_counts_.size(); ++worker) {
+    if (perf_counts_[worker].Empty()) continue;
+    counted = true;
+    *trace_os_ << "Seed: " << seed_ << ", worker " << worker << ": " << perf_counts_[worker].ToString() << std::endl;
+    perf_counts_[worker] = PerfCounters::Counts();
+  }
+  if (!counted) {
+    *trace_os_ << "Seed: " << seed_ << ", " << PerfCounters::Counts().ToString() << std::endl;
+  }
+}
+
+// Moves the members of an escalated generation that the deeper mode has not
+// reached earlier into kept_, and expands them with the deeper unary operators.
+template<class S>
+bool TchislaSolver::GenerationCreator::AddKept(size_t level) {
+  Timeline::Scope scope("keep", "level", level + 1);
+  GenerationPtr escalated = std::move(solver.escalated_[level]);
+  GenerationPtr& kept = solver.kept_[level];
+  kept = std::make_unique<PartitionedList<const Expr*>>(1);
+  for (const Expr* expr : *escalated) {
+    if (solver.AddReachableValueIfNotExist(*expr)) kept->push_back(0, expr);
+  }
+  for (const Expr* expr : *kept) {
+    RETURN_IF_TRUE(Expand<S>(expr));
+  }
+  return false;
+}
+
+template<class S>
+bool TchislaSolver::GenerationCreator::AddCandidate(const Expr* expr, bool new_operator) {
+  RETURN_IF_TRUE(solver.stop_.load());
   if (expr->IsInt() && expr->GetIntUnsafe() == solver.target_) {
-    solver.found.store(true);
-    solver.result_ = expr->ToString();
+    solver.PublishResult<S>(expr);
     return true;
   }
-  if (expr->GetDouble() < VALUE_MIN_LIMIT) return false;
-  if (expr->GetDouble() > VALUE_MAX_LIMIT) return false;
-  if (solver.search_mode_ == 0 && !expr->IsInt() && expr->GetDoubleUnsafe() > solver.target_) return false;
-  if (solver.AddReachableValueIfNotExist(*expr)) {
+  if (expr->GetDouble() < solver.config_.value_min_limit) return false;
+  if (expr->GetDouble() > solver.config_.value_max_limit) return false;
+  if (S::PRUNE_BIG_NON_INTEGERS && !expr->IsInt() && expr->GetDoubleUnsafe() > solver.target_) return false;
+  if constexpr (S::DELTA_CANDIDATES) {
+    if (!new_operator && !(S::Base::PRUNE_BIG_NON_INTEGERS && !expr->IsInt() &&
+        expr->GetDoubleUnsafe() > solver.target_)) return false;
+  }
+  if constexpr (S::STREAM_CANDIDATES) {
+    auto checkpoint = expr_pool.GetCheckpoint();
     expr_pool.CommitLastObject();
+    bool found = Expand<S>(expr);
+    expr_pool.Rollback(checkpoint);
+    return found;
+  }
+  if constexpr (S::STAGE_CANDIDATES) {
+    // The shared set is not written before the merge phase, so it can be read
+    // without locks here. Staged values are counted once they win the merge.
+    auto key = solver.MakeKey(*expr);
+    if (!solver.reachable_values_.ContainsUnlocked(key) &&
+        staging.Insert(key.set_id, key.value, expr)) {
+      Commit(expr);
+    }
+    return false;
+  }
+  if constexpr (S::BEAM_CANDIDATES) {
+    double score = BeamScore(*expr, solver.target_);
+    if (!beam.Admits(score)) return false;
+    auto key = solver.MakeKey(*expr);
+    if (!solver.reachable_values_.ContainsUnlocked(key)) beam.Offer(score, { key.set_id, key.value }, made);
+    return false;
+  }
+  if constexpr (S::SORT_CANDIDATES) {
+    // Only the provenance is recorded, the candidate is built again if it wins.
+    auto key = solver.MakeKey(*expr);
+    size_t group = ReachableSet::Group(key);
+    if (sorting.Append(group, key.value, made)) CompactSorting(group);
+    return false;
+  }
+  if (solver.AddReachableValueIfNotExist(*expr)) {
+    expr = Commit(expr);
     solver.current_generation_->push_back(part_id, expr);
-    RETURN_IF_TRUE(AddFactorial(expr));
-    RETURN_IF_TRUE(AddSquareRoot(expr));
+    ++num_new_candidates;
+    RETURN_IF_TRUE(Expand<typename S::Full>(expr));
   }
   return false;
 }
 
+template<class S>
 bool TchislaSolver::GenerationCreator::AddLiteral(size_t repeats) {
   ostringstream ss;
   while (repeats-- > 0) ss << solver.seed_;
-  return AddCandidate(expr_pool.EmplaceObject<LiteralExpr>(ss.str()));
+  // Only beam searches get this deep, such literals overflow int64_t and
+  // exceed the value max limit anyway.
+  if (ss.str().size() > 18) return false;
+  return AddCandidate<S>(Make<S, LiteralExpr>(ss.str()));
 }
 
-bool TchislaSolver::GenerationCreator::AddAddition(const Expr* expr1, const Expr* expr2) {
-  return AddCandidate(expr_pool.EmplaceObject<AddExpr>(expr1, expr2));
-}
-
-bool TchislaSolver::GenerationCreator::AddSubtraction(const Expr* expr1, const Expr* expr2) {
-  if (expr1->GetDouble() > expr2->GetDouble()) {
-    return AddCandidate(expr_pool.EmplaceObject<SubExpr>(expr1, expr2));
-  } else {
-    return AddCandidate(expr_pool.EmplaceObject<SubExpr>(expr2, expr1));
-  }
+template<class S>
+bool TchislaSolver::GenerationCreator::Expand(const Expr* expr) {
+  return S::UnaryOperators::template Apply<S>(*this, expr);
 }
 
-bool TchislaSolver::GenerationCreator::AddMultiplication(const Expr* expr1, const Expr* expr2) {
-  RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<MulExpr>(expr1, expr2)));
-  if (solver.search_mode_ > 1) {
-    if (!expr1->IsInt()) {
-      const Expr* expr = expr_pool.EmplaceObject<SqrtMulExpr>(expr2, expr1);
-      if (expr->IsInt()) RETURN_IF_TRUE(AddCandidate(expr));
-    }
-    if (!expr2->IsInt()) {
-      const Expr* expr = expr_pool.EmplaceObject<SqrtMulExpr>(expr1, expr2);
-      if (expr->IsInt()) RETURN_IF_TRUE(AddCandidate(expr));
+template<class S, class T, class... Args>
+const Expr* TchislaSolver::GenerationCreator::Make(Args&&... args) {
+  const Expr* expr = expr_pool.EmplaceObject<T>(std::forward<Args>(args)...);
+  if constexpr (S::SORT_CANDIDATES || S::BEAM_CANDIDATES) {
+    if constexpr (std::is_same_v<T, LiteralExpr>) {
+      // Literals cannot be built from children, there is one per generation.
+      expr_pool.CommitLastObject();
+      made = { nullptr, expr, nullptr, 0 };
+    } else {
+      made = Provenance::template Of<T>(args...);
     }
   }
-  return false;
-}
-
-bool TchislaSolver::GenerationCreator::AddDivision(const Expr* expr1, const Expr* expr2) {
-  if (expr1->GetDouble() < Expr::DOUBLE_PRECISION ||
-    expr2->GetDouble() < Expr::DOUBLE_PRECISION) return false;
-  RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<DivExpr>(expr1, expr2)));
-  return AddCandidate(expr_pool.EmplaceObject<DivExpr>(expr2, expr1));
+  return expr;
 }
 
-bool TchislaSolver::GenerationCreator::AddPower(const Expr* expr1, const Expr* expr2) {
-  if (expr2->IsInt()) {
-    if (expr2->GetIntUnsafe() <= POWER_LIMIT) {
-      RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<PowExpr>(expr1, expr2)));
-      if (solver.search_mode_ > 0) {
-        RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<NegPowExpr>(expr1, expr2)));
-      }
-    }
-    RETURN_IF_TRUE(AddMultiSqrtPower(expr1, expr2));
-  }
-  if (expr1->IsInt()) {
-    if (expr1->GetIntUnsafe() <= POWER_LIMIT) {
-      RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<PowExpr>(expr2, expr1)));
-      if (solver.search_mode_ > 0) {
-        RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<NegPowExpr>(expr2, expr1)));
-      }
-    }
-    return AddMultiSqrtPower(expr2, expr1);
+template<class T>
+const Expr* TchislaSolver::GenerationCreator::Provenance::Build(
+    GenerationCreator& creator, const Provenance& provenance) {
+  const Expr* expr;
+  if constexpr (std::is_constructible_v<T, int, const Expr*, const Expr*>) {
+    expr = creator.expr_pool.EmplaceObject<T>(provenance.sqrt_times, provenance.child, provenance.other_child);
+  } else if constexpr (std::is_constructible_v<T, const Expr*, const Expr*>) {
+    expr = creator.expr_pool.EmplaceObject<T>(provenance.child, provenance.other_child);
+  } else {
+    expr = creator.expr_pool.EmplaceObject<T>(provenance.child);
   }
-  return false;
+  return creator.Commit(expr);
 }
 
-bool TchislaSolver::GenerationCreator::AddMultiSqrtPower(const Expr* expr1, const Expr* expr2) {
-  int64_t power = expr2->GetIntUnsafe();
-  int sqrt_times = 0;
-  while ((power & 1) == 0) {
-    power >>= 1;
-    ++sqrt_times;
-    const Expr* expr = expr_pool.EmplaceObject<MultiSqrtPowExpr>(sqrt_times, expr1, expr2);
-    if (solver.search_mode_ > 0 || expr->IsInt()) {
-      RETURN_IF_TRUE(AddCandidate(expr));
-      RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<NegMultiSqrtPowExpr>(sqrt_times, expr1, expr2)));
-    }
+const Expr* TchislaSolver::GenerationCreator::Commit(const Expr* expr) {
+  if (solver.UseValueOnly()) {
+    Value value = *expr;
+    expr = expr_pool.EmplaceObject<ValueExpr>(value);
   }
-  return false;
+  expr_pool.CommitLastObject();
+  return expr;
 }
 
-bool TchislaSolver::GenerationCreator::AddFactorial(const Expr* expr) {
-  if (expr->IsInt() && expr->GetIntUnsafe() <= FACTORIAL_LIMIT) {
-    return AddCandidate(expr_pool.EmplaceObject<FactorialExpr>(expr));
-  }
-  return false;
+template<class S, class Op, class... Operands>
+bool TchislaSolver::GenerationCreator::Emit(const Operands*... operands) {
+  const Expr* expr = Make<S, typename Op::ExprType>(operands...);
+  if (!Op::Keeps(*expr, *operands..., context)) return false;
+  return AddCandidate<S>(expr, IsNewOperator<S, Op>(*expr, *operands...));
 }
 
-bool TchislaSolver::GenerationCreator::AddSquareRoot(const Expr* expr) {
-  if (expr->IsInt() && expr->GetIntUnsafe() > 0) {
-    if (solver.search_mode_ > 1 ||
-        (solver.search_mode_ > 0 && expr->GetIntUnsafe() == solver.seed_)) {
-      RETURN_IF_TRUE(AddCandidate(expr_pool.EmplaceObject<SqrtExpr>(expr)));
-      return AddCandidate(expr_pool.EmplaceObject<DoubleSqrtExpr>(expr));
+// A result is new to the escalated mode unless an operator of the same family
+// in the base mode kept it.
+template<class S, class Op, class... Operands>
+bool TchislaSolver::GenerationCreator::IsNewOperator(
+    const Value& result, const Operands&... operands) const {
+  if constexpr (S::DELTA_CANDIDATES) {
+    using Family = typename Op::Family;
+    if constexpr (Op::ARITY == 2) {
+      return !S::Base::BinaryOperators::template FamilyKeeps<Family>(context, result, operands...);
     } else {
-      expr = expr_pool.EmplaceObject<SqrtExpr>(expr);
-      if (expr->IsInt()) {
-        return AddCandidate(expr);
-      }
+      return !S::Base::UnaryOperators::template FamilyKeeps<Family>(context, result, operands...);
     }
+  } else {
+    return false;
   }
-  return false;
 }
@@ -1,40 +1,226 @@
 ﻿#pragma once
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <mutex>
 
+#include "cold-generation.h"
 #include "expr.h"
+#include "operators.h"
+#include "perf-counters.h"
+#include "timeline.h"
 #include "util.h"
 
 
+// Bytes allocated by each subsystem of the solver.
+struct MemoryUsage {
+  size_t expr_pools = 0;
+  size_t generations = 0;
+  size_t reachable_values = 0;
+  size_t staging = 0;
+
+  size_t Total() const { return expr_pools + generations + reachable_values + staging; }
+  void MergeMax(const MemoryUsage& other);
+  std::string ToString() const;
+};
+
+
+struct SolveStatus {
+  enum Code {
+    kNotFound,
+    kFound,
+    kDeadlineExceeded,
+    kCancelled,
+    kCandidateLimitExceeded,
+    kMemoryLimitExceeded,
+  };
+
+  Code code = kNotFound;
+  size_t completed_generations = 0;
+  std::vector<size_t> generation_sizes;
+  size_t num_candidates = 0;
+  // Subsystem peaks are sampled at generation boundaries, peak_total_memory
+  // also at every budget check.
+  MemoryUsage peak_memory;
+  size_t peak_total_memory = 0;
+  // False when the generations were pruned to a beam, a found result may then
+  // use more digits than needed.
+  bool optimal = true;
+
+  bool Stopped() const { return code != kNotFound && code != kFound; }
+  std::string ToString() const;
+};
+
+
 class TchislaSolver {
 public:
-  static double VALUE_MAX_LIMIT;
-  static double VALUE_MIN_LIMIT;
-  static int64_t POWER_LIMIT;
-  static int64_t FACTORIAL_LIMIT;
-  static size_t MUILT_THREADS_THRESHOLD;
+  using Clock = std::chrono::steady_clock;
+
+  // The limits of a solver. Each solver keeps its own copy and binds its
+  // precision on every thread it searches with, so solvers with different
+  // configs can run concurrently in one process.
+  struct Config {
+    // Reachable values outside [value_min_limit, value_max_limit] are dropped.
+    double value_max_limit = 1e15;
+    double value_min_limit = 1e-8;
+    int64_t power_limit = 40;
+    int64_t factorial_limit = 20;
+    // Generations bigger than this are crossed by several threads.
+    size_t multi_threads_threshold = 10000;
+    // Reachable integers below this bound are kept in a dense bitmap, the hash
+    // set only holds bigger integers and non-integers.
+    uint64_t bitmap_limit = 1 << 20;
+    // Doubles within this of an integer are kept as that integer.
+    double precision = Value::DEFAULT_PRECISION;
+  };
+
+  // Starts with the cheapest mode and, when the target is not found within the
+  // escalation depth, extends the generations built so far with the candidates
+  // of each deeper mode instead of searching again from scratch.
+  static constexpr int AUTO_SEARCH_MODE = -1;
+
+  // How new candidates are deduplicated against the reachable values. The hash
+  // set probes for every candidate, sort-merge collects the candidates of a
+  // generation as records, sorts them and merge joins them with the sorted
+  // reachable values. Auto search always uses the hash set.
+  enum DedupEngine {
+    kHashSet,
+    kSortMerge,
+  };
 
   TchislaSolver(int64_t target, int64_t seed, int search_mode = 0,
       std::ostream* trace_os = nullptr);
+  TchislaSolver(const Config& config, int64_t target, int64_t seed, int search_mode = 0,
+      std::ostream* trace_os = nullptr);
 
+  // Budgets are checked in batches inside the cross loops, a search that exceeds
+  // one of them stops early and reports why through Status(). A generation that
+  // is forecast to exceed one by far is not started at all, see
+  // ForecastGeneration().
+  void SetDeadline(Clock::time_point deadline) { deadline_ = deadline; }
+  void SetCancellationToken(const std::atomic_bool* token) { cancel_token_ = token; }
+  void SetMaxCandidates(size_t max_candidates) { max_candidates_ = max_candidates; }
+  void SetMemoryLimit(size_t bytes) { memory_limit_ = bytes; }
+  void SetEscalationDepth(int digits) { escalation_depth_ = digits; }
+  // A combination of OperatorOption flags, every combination is compiled into
+  // its own search loops.
+  void SetOperatorOptions(unsigned options) { operator_options_ = options; }
+  void SetDedupEngine(DedupEngine engine) { dedup_engine_ = engine; }
+  // Stores nothing but the values of the generations, as ValueExpr, and
+  // reconstructs the expression of the result from them through the inverse
+  // operators once the target is found. Auto search ignores it.
+  void SetValueOnly(bool value_only) { value_only_ = value_only; }
+  // With value-only search, compresses every generation once it is built, see
+  // ColdGeneration, and frees the expressions of its members. The cross loops
+  // then decode the generations block by block, in ascending order of their
+  // values. Sort-merge, beam search and iterative deepening ignore it.
+  void SetCompressGenerations(bool compress) { compress_generations_ = compress; }
+  // Keeps only the width best candidates of every generation, scored by their
+  // distance to the target in log space less the factor they share with it.
+  // Memory then grows with width times the depth instead of exponentially, but
+  // the result is not guaranteed to be optimal. 0 searches exhaustively, auto
+  // search ignores it.
+  void SetBeamWidth(size_t width) { beam_width_ = width; }
+  // Only stores the generations up to digits and searches the deeper digit
+  // counts one at a time, top down from the target, see Deepening. Memory stays
+  // at that of the stored generations, in exchange for repeated work, and
+  // results are provably optimal up to 2 * digits + 1 digits. 0 searches
+  // breadth first only, auto and beam search ignore it.
+  void SetIterativeDeepening(int digits) { deepening_depth_ = digits; }
+  // Grows the hash sets for the members forecast for a generation before it
+  // starts, instead of resizing them step by step while it runs. That saves the
+  // resizes, and the old and new buckets they hold at once, of generations that
+  // run to completion, but a generation that finds the target early has grown
+  // the sets for nothing. Sort-merge ignores it.
+  void SetPresizeSets(bool presize) { presize_sets_ = presize; }
+
+  // Records generations, cross work, set resizes and thread joins of every
+  // worker into timeline, which must outlive the solver.
+  void SetTimeline(Timeline* timeline);
+  // Reads the hardware counters of every worker while it builds a generation,
+  // crossing and deduplicating, and prints them after the generation size in
+  // the trace, see PerfCounters.
+  void SetPerfCounters(bool enabled) { perf_counters_ = enabled; }
+
+  // Expands up to search_depth more generations. The last one is only streamed
+  // through the target check, so a solver cannot be resumed once it has run
+  // out of depth.
   bool Solve(int search_depth = 20);
+  // Expands up to search_depth more generations like Solve(), but keeps the
+  // last one too, so that the members of all of them can be looked up through
+  // ForEachMember(). Auto search only builds with its cheapest mode.
+  bool BuildGenerations(int search_depth);
 
-  std::string Result() const { return result_; }
-  size_t Generations() const { return generations_.size() + 1; }
+  // Safe to call while another thread solves, empty until the target is found.
+  std::string Result() const;
+  // Digits of the result when one is found.
+  size_t Generations() const { return deepened_digits_ != 0 ? deepened_digits_ : generations_.size() + 1; }
+  const SolveStatus& Status() const { return status_; }
+  MemoryUsage GetMemoryUsage() const;
+  const Config& GetConfig() const { return config_; }
+  // Whether the generations built so far reach value, O(1) below the bitmap
+  // limit. Once Solve() has streamed its last generation only the values below
+  // the bitmap limit are known, and none with kSortMerge. Values below 1 are
+  // never reachable.
+  bool IsReachable(int64_t value) const;
+  // Calls f(expr, digits) for every member of the stored generations. Members of
+  // compressed generations are decoded, expr then only lives during the call.
+  template<class F> void ForEachMember(const F& f) const {
+    for (size_t level = 0; level < generations_.size(); ++level) {
+      if (level < cold_generations_.size()) {
+        ColdGeneration::Reader reader(*cold_generations_[level]);
+        while (const auto* block = reader.NextBlock()) {
+          for (const ValueExpr& expr : *block) f(&expr, level + 1);
+        }
+      } else {
+        for (const Expr* expr : *generations_[level]) f(expr, level + 1);
+      }
+    }
+  }
 
 private:
   struct GenerationCreator;
+  template<int SearchMode, unsigned Options> struct Strategy;
+  template<class S> struct Streaming;
+  template<class S> struct Staged;
+  template<class S> struct Sorted;
+  template<class S> struct Beam;
+  template<class From, class To> struct Escalation;
+  template<class BinaryOperators, class UnaryOperators> struct Reconstruction;
+  template<class S> struct Deepening;
 
   TchislaSolver(const TchislaSolver&) = delete;
   TchislaSolver& operator=(const TchislaSolver&) = delete;
 
+  const Config config_;
   const int64_t target_;
   const int64_t seed_;
   const int search_mode_;
+  int active_mode_ = 0;
+  int escalation_depth_ = 7;
+  unsigned operator_options_ = DEFAULT_OPERATOR_OPTIONS;
+  DedupEngine dedup_engine_ = kHashSet;
+  bool value_only_ = false;
+  bool compress_generations_ = false;
+  size_t beam_width_ = 0;
+  int deepening_depth_ = 0;
+  bool presize_sets_ = false;
+  // The digit budget at which iterative deepening found the target.
+  size_t deepened_digits_ = 0;
   std::ostream* trace_os_ = nullptr;
+  Timeline* timeline_ = nullptr;
+  bool perf_counters_ = false;
+  // Counted by the worker of the same index since the last generation was
+  // traced, a deque since workers keep pointing into it as it grows.
+  std::deque<PerfCounters::Counts> perf_counts_;
 
-  ConcurrentNumericSet<11> reachable_values_;
+  using ReachableSet = ConcurrentNumericSet<11>;
+  ReachableSet reachable_values_;
+  // Holds the reachable values instead of reachable_values_ with kSortMerge.
+  SortedNumericSet<ReachableSet::NUM_GROUPS> sorted_values_;
+  std::atomic<size_t> staging_bytes_ = 0;
 
   std::vector<GenerationCreator> creators_;
 
@@ -44,37 +230,170 @@ private:
   using GenerationPtr = std::unique_ptr<PartitionedList<const Expr*>>;
   GenerationPtr current_generation_;
   std::vector<GenerationPtr> generations_;
-  std::atomic_bool found = false;
+  // The leading generations that are compressed, their lists in generations_
+  // are left empty.
+  std::vector<std::unique_ptr<ColdGeneration>> cold_generations_;
+  // While escalating, escalated_ holds the generations of the shallower mode and
+  // kept_ those of their members that keep their digit count, generations_ only
+  // gets the members the deeper mode adds.
+  std::vector<GenerationPtr> escalated_;
+  std::vector<GenerationPtr> kept_;
+  bool exhausted_ = false;
+  std::atomic_bool stop_ = false;
+  std::atomic<int> stop_code_ = SolveStatus::kNotFound;
+  // The first worker that finds the target renders it into result_.
+  mutable std::mutex result_mutex_;
   std::string result_;
+  SolveStatus status_;
+
+  // What the generations searched in the current mode cost, the forecast of
+  // the next one is fitted to the last two.
+  struct GenerationCost {
+    size_t pairs;
+    size_t members;
+    double seconds;
+    size_t bytes;
+  };
+  struct GenerationForecast {
+    // Pairs of members the generation crosses, 0 when there is nothing to fit
+    // the forecast to yet.
+    size_t pairs = 0;
+    size_t members = 0;
+    double seconds = 0;
+    size_t bytes = 0;
+  };
+  std::vector<GenerationCost> generation_costs_;
+
+  Clock::time_point deadline_ = Clock::time_point::max();
+  const std::atomic_bool* cancel_token_ = nullptr;
+  size_t max_candidates_ = SIZE_MAX;
+  std::atomic<size_t> num_candidates_ = 0;
+  size_t memory_limit_ = SIZE_MAX;
+  std::atomic<size_t> peak_total_memory_ = 0;
+
+  bool Stop(SolveStatus::Code code);
+  bool CheckBudget();
+  size_t SampleMemoryUsage();
+  MemoryUsage UpdateMemoryPeaks();
+  void UpdateStatus();
+
+  bool SolveEscalating(int search_depth);
+  template<class F> static bool DispatchOperators(unsigned options, const F& solve);
+  bool SolveInMode(int search_mode, int search_depth, bool stream_last);
+  template<class S> bool SolveWith(int search_depth, bool stream_last);
+  size_t NumPairs() const;
+  GenerationForecast ForecastGeneration() const;
+  bool AdmitGeneration(const GenerationForecast& forecast, bool streamed);
+  template<class From, class To> bool Escalate();
+  bool UseDeepening() const;
+  bool SolveDeepening(int search_depth);
+  template<class S> bool DeepenWith(int search_depth);
+  template<class S> bool NextGeneration();
 
+  size_t GenerationSize(size_t level) const;
+  size_t LastGenerationSize() const;
   bool UseMultiThread() const;
-  void MultiThreadCrossGeneration(size_t num_loops);
+  template<class S> void MultiThreadCrossGeneration(size_t num_loops);
+  bool UseBeam() const;
+  template<class S> void BeamGeneration(size_t num_loops);
+  bool UseSortMerge() const;
+  template<class S> void SortMergeGeneration(size_t num_loops);
+  void MergeSorted(size_t num_workers);
+  template<class F> void RunWorkers(size_t num_workers, const F& work);
 
+  bool UseValueOnly() const;
+  bool UseCompression() const;
+  void CompressGeneration();
+  template<class S> std::string Render(const Expr* expr);
+  // Renders expr as the result, unless another worker already found one.
+  template<class S> void PublishResult(const Expr* expr);
+
+  ReachableSet::Key MakeKey(const Value& value) const;
   bool AddReachableValueIfNotExist(const Expr& expr);
 
+  void AddCreator();
   void NewGeneration(size_t num_new_parts);
+  PerfCounters::Counts* PerfCountsOf(size_t worker) { return perf_counters_ ? &perf_counts_[worker] : nullptr; }
+  void TracePerfCounts();
   void EndGeneration();
 
   struct GenerationCreator {
     TchislaSolver& solver;
     ObjectPool<OBJ_POOL_SIZE>& expr_pool;
     size_t part_id;
+    size_t num_new_candidates = 0;
+    Timeline::Buffer* timeline_buffer = nullptr;
+    const OperatorContext context;
+
+    // Candidates of multithreaded generations are first deduplicated here and
+    // merged into reachable_values_ in bulk, see MultiThreadCrossGeneration().
+    StagingBuffer<const Expr*, ReachableSet::NUM_SETS> staging;
+    size_t num_staged = 0;
+    std::vector<const Expr*> merged;
+
+    // How to build a candidate again once it has won the merge of a sort-merge
+    // generation, see SortMergeGeneration(). A null build marks a candidate that
+    // is already committed as child.
+    struct Provenance {
+      const Expr* (*build)(GenerationCreator& creator, const Provenance& provenance);
+      const Expr* child;
+      const Expr* other_child;
+      int sqrt_times;
+
+      template<class T> static const Expr* Build(GenerationCreator& creator, const Provenance& provenance);
+
+      template<class T> static Provenance Of(const Expr* child) {
+        return { &Build<T>, child, nullptr, 0 };
+      }
+      template<class T> static Provenance Of(const Expr* child, const Expr* other_child) {
+        return { &Build<T>, child, other_child, 0 };
+      }
+      template<class T> static Provenance Of(int sqrt_times, const Expr* child, const Expr* other_child) {
+        return { &Build<T>, child, other_child, sqrt_times };
+      }
+    };
+    using SortingRecords = SortingBuffer<Provenance, ReachableSet::NUM_GROUPS>;
+    SortingRecords sorting;
+    size_t num_sorted = 0;
+    // Provenance of the last candidate made for a sorted or beam strategy.
+    Provenance made;
+    // The best candidates of a beam generation, see BeamGeneration().
+    BeamBuffer<Provenance> beam;
 
     GenerationCreator(TchislaSolver& solver, size_t part_id)
-      : solver(solver), expr_pool(*solver.expr_pools_[part_id]), part_id(part_id) { }
+      : solver(solver), expr_pool(*solver.expr_pools_[part_id]), part_id(part_id),
+      context{ solver.seed_, solver.config_.precision, solver.config_.power_limit,
+        solver.config_.factorial_limit },
+      staging(&solver.staging_bytes_), sorting(&solver.staging_bytes_), beam(&solver.staging_bytes_) { }
+
+    bool CheckBudget();
+
+    void MergeStaged(size_t first_set_id, size_t num_workers);
+    template<class S> bool ExpandMerged();
+    template<class S> bool ExpandBeam();
+    // Commits the expression made last. With value-only search it is replaced,
+    // at the same address, by a ValueExpr of its value.
+    const Expr* Commit(const Expr* expr);
+    void CompactSorting(size_t group);
+
+    // All members below are specialized on the search strategy, so each search
+    // mode gets its own cross loop without any per candidate mode test.
+    template<class S> bool CrossPair(size_t index);
+    template<class S> bool CrossGeneration(const GenerationPtr& g1, const GenerationPtr& g2);
+    template<class S> bool CrossColdGeneration(const ColdGeneration& g1, const ColdGeneration& g2);
 
-    bool CrossGeneration(const GenerationPtr& g1, const GenerationPtr& g2);
+    template<class S> bool AddKept(size_t level);
+    // new_operator marks candidates of operators the escalated mode did not have.
+    template<class S> bool AddCandidate(const Expr* expr, bool new_operator = false);
 
-    bool AddCandidate(const Expr* expr);
+    template<class S> bool AddLiteral(size_t repeats);
+    // Applies the unary operators of S to a new member.
+    template<class S> bool Expand(const Expr* expr);
 
-    bool AddLiteral(size_t repeats);
-    bool AddAddition(const Expr* expr1, const Expr* expr2);
-    bool AddSubtraction(const Expr* expr1, const Expr* expr2);
-    bool AddMultiplication(const Expr* expr1, const Expr* expr2);
-    bool AddDivision(const Expr* expr1, const Expr* expr2);
-    bool AddPower(const Expr* expr1, const Expr* expr2);
-    bool AddMultiSqrtPower(const Expr* expr1, const Expr* expr2);
-    bool AddFactorial(const Expr* expr);
-    bool AddSquareRoot(const Expr* expr);
+    // Called back by the operators of S, see operators.h.
+    template<class S, class T, class... Args> const Expr* Make(Args&&... args);
+    template<class S, class Op, class... Operands> bool Emit(const Operands*... operands);
+    template<class S, class Op, class... Operands>
+    bool IsNewOperator(const Value& result, const Operands&... operands) const;
   };
 };
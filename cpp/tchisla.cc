@@ -0,0 +1,115 @@
+﻿#include "tchisla.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "tchisla-solver.h"
+
+static_assert(static_cast<int>(TCHISLA_FOUND) == SolveStatus::kFound &&
+    static_cast<int>(TCHISLA_MEMORY_LIMIT_EXCEEDED) == SolveStatus::kMemoryLimitExceeded,
+    "tchisla_status out of sync with SolveStatus::Code");
+
+struct tchisla_solver {
+  std::atomic_bool cancelled = false;
+  std::unique_ptr<TchislaSolver> solver;
+};
+
+static TchislaSolver::Config ToConfig(const tchisla_config& config) {
+  TchislaSolver::Config result;
+  result.value_max_limit = config.value_max_limit;
+  result.value_min_limit = config.value_min_limit;
+  result.power_limit = config.power_limit;
+  result.factorial_limit = config.factorial_limit;
+  result.multi_threads_threshold = config.multi_threads_threshold;
+  result.bitmap_limit = config.bitmap_limit;
+  result.precision = config.precision;
+  return result;
+}
+
+void tchisla_config_init(tchisla_config* config) {
+  TchislaSolver::Config defaults;
+  config->value_max_limit = defaults.value_max_limit;
+  config->value_min_limit = defaults.value_min_limit;
+  config->power_limit = defaults.power_limit;
+  config->factorial_limit = defaults.factorial_limit;
+  config->multi_threads_threshold = defaults.multi_threads_threshold;
+  config->bitmap_limit = defaults.bitmap_limit;
+  config->precision = defaults.precision;
+}
+
+tchisla_solver* tchisla_create(const tchisla_config* config, int64_t target, int64_t seed, int search_mode) {
+  if (target <= 0 || seed <= 0 || search_mode < TchislaSolver::AUTO_SEARCH_MODE || search_mode > 2) {
+    return nullptr;
+  }
+  try {
+    std::unique_ptr<tchisla_solver> handle(new tchisla_solver);
+    TchislaSolver::Config solver_config = config != nullptr ? ToConfig(*config) : TchislaSolver::Config();
+    handle->solver.reset(new TchislaSolver(solver_config, target, seed, search_mode));
+    handle->solver->SetCancellationToken(&handle->cancelled);
+    return handle.release();
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void tchisla_destroy(tchisla_solver* solver) {
+  delete solver;
+}
+
+void tchisla_set_time_limit(tchisla_solver* solver, double seconds) {
+  if (seconds <= 0) {
+    solver->solver->SetDeadline(TchislaSolver::Clock::time_point::max());
+    return;
+  }
+  auto limit = std::chrono::duration<double>(seconds);
+  solver->solver->SetDeadline(TchislaSolver::Clock::now() +
+      std::chrono::duration_cast<TchislaSolver::Clock::duration>(limit));
+}
+
+void tchisla_set_memory_limit(tchisla_solver* solver, size_t bytes) {
+  solver->solver->SetMemoryLimit(bytes == 0 ? SIZE_MAX : bytes);
+}
+
+void tchisla_set_escalation_depth(tchisla_solver* solver, int digits) {
+  solver->solver->SetEscalationDepth(digits);
+}
+
+int tchisla_solve(tchisla_solver* solver, int search_depth) {
+  // No exception may cross the C interface.
+  try {
+    solver->solver->Solve(search_depth);
+  } catch (const std::bad_alloc&) {
+    return TCHISLA_MEMORY_LIMIT_EXCEEDED;
+  } catch (...) {
+    return TCHISLA_INTERNAL_ERROR;
+  }
+  return solver->solver->Status().code;
+}
+
+void tchisla_cancel(tchisla_solver* solver) {
+  solver->cancelled.store(true);
+}
+
+size_t tchisla_digits(const tchisla_solver* solver) {
+  return solver->solver->Status().code == SolveStatus::kFound ? solver->solver->Generations() : 0;
+}
+
+size_t tchisla_result(const tchisla_solver* solver, char* buffer, size_t size) {
+  std::string result;
+  try {
+    result = solver->solver->Result();
+  } catch (...) {
+    // Reported as empty, like a result that is not found yet.
+  }
+  if (size > 0) {
+    size_t length = std::min(result.size(), size - 1);
+    std::memcpy(buffer, result.data(), length);
+    buffer[length] = '\0';
+  }
+  return result.size();
+}
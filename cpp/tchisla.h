@@ -0,0 +1,69 @@
+﻿#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// C interface of libtchisla. Every solver keeps its own config, so solvers with
+// different configs can run concurrently on different threads. A solver itself
+// is used by one thread at a time, except for tchisla_cancel() and
+// tchisla_result(), which may be called while another thread solves.
+
+// See TchislaSolver::Config.
+typedef struct tchisla_config {
+  double value_max_limit;
+  double value_min_limit;
+  int64_t power_limit;
+  int64_t factorial_limit;
+  size_t multi_threads_threshold;
+  uint64_t bitmap_limit;
+  double precision;
+} tchisla_config;
+
+// See SolveStatus::Code. TCHISLA_INTERNAL_ERROR has no counterpart there, it
+// reports an exception the solver threw on the calling thread.
+enum tchisla_status {
+  TCHISLA_NOT_FOUND,
+  TCHISLA_FOUND,
+  TCHISLA_DEADLINE_EXCEEDED,
+  TCHISLA_CANCELLED,
+  TCHISLA_CANDIDATE_LIMIT_EXCEEDED,
+  TCHISLA_MEMORY_LIMIT_EXCEEDED,
+  TCHISLA_INTERNAL_ERROR,
+};
+
+typedef struct tchisla_solver tchisla_solver;
+
+// Fills config with the defaults.
+void tchisla_config_init(tchisla_config* config);
+
+// config may be null for the defaults, search_mode -1 is auto search. Returns
+// null when the solver cannot be created.
+tchisla_solver* tchisla_create(const tchisla_config* config, int64_t target, int64_t seed, int search_mode);
+void tchisla_destroy(tchisla_solver* solver);
+
+// Limits the solver to the given wall-clock time, 0 for no limit.
+void tchisla_set_time_limit(tchisla_solver* solver, double seconds);
+// Limits the memory the solver allocates, 0 for no limit.
+void tchisla_set_memory_limit(tchisla_solver* solver, size_t bytes);
+// See TchislaSolver::SetEscalationDepth().
+void tchisla_set_escalation_depth(tchisla_solver* solver, int digits);
+
+// Returns a tchisla_status. No exception crosses this interface, but one thrown
+// on a worker thread of a multithreaded generation still terminates the
+// process, as it does for the C++ interface.
+int tchisla_solve(tchisla_solver* solver, int search_depth);
+void tchisla_cancel(tchisla_solver* solver);
+
+// Digits of the found result, 0 if none.
+size_t tchisla_digits(const tchisla_solver* solver);
+// Copies the result into buffer, truncated to size - 1 bytes and terminated
+// like snprintf, and returns its full length. The result is empty until found.
+size_t tchisla_result(const tchisla_solver* solver, char* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,46 @@
+﻿#include "timeline.h"
+
+#include <iomanip>
+
+static void WriteString(std::ostream& os, const std::string& s) {
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') os << '\\';
+    os << c;
+  }
+  os << '"';
+}
+
+void Timeline::Write(std::ostream& os) const {
+  os << "{\"traceEvents\":[\n";
+  bool first = true;
+  auto separate = [&]() {
+    if (!first) os << ",\n";
+    first = false;
+  };
+  for (const Buffer& buffer : buffers_) {
+    separate();
+    os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.tid_
+      << ",\"args\":{\"name\":";
+    WriteString(os, buffer.name_);
+    os << "}}";
+  }
+  os << std::fixed << std::setprecision(3);
+  for (const Buffer& buffer : buffers_) {
+    for (const Buffer::Event& event : buffer.events_) {
+      separate();
+      double us = std::chrono::duration<double, std::micro>(event.time - start_).count();
+      os << "{\"name\":";
+      WriteString(os, event.name);
+      os << ",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << buffer.tid_
+        << ",\"ts\":" << us;
+      if (event.arg_name != nullptr) {
+        os << ",\"args\":{";
+        WriteString(os, event.arg_name);
+        os << ':' << event.arg << '}';
+      }
+      os << '}';
+    }
+  }
+  os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
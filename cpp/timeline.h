@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Records begin and end events of the solver's threads and writes them in the
+// Chrome trace-event format, e.g. for chrome://tracing or ui.perfetto.dev.
+//
+// Every thread records into its own buffer, so recording takes no lock. A
+// thread binds its buffer with a Binding and Scope records into whichever
+// buffer the current thread has bound, which costs a single branch when none is.
+class Timeline {
+public:
+  class Buffer {
+  public:
+    Buffer(std::string name, size_t tid) : name_(std::move(name)), tid_(tid) { }
+
+    void Record(char phase, const char* name, const char* arg_name, int64_t arg) {
+      events_.push_back({ phase, name, arg_name, arg, Clock::now() });
+    }
+
+  private:
+    friend class Timeline;
+
+    struct Event {
+      char phase;
+      const char* name;
+      const char* arg_name;
+      int64_t arg;
+      std::chrono::steady_clock::time_point time;
+    };
+
+    std::string name_;
+    size_t tid_;
+    std::vector<Event> events_;
+  };
+
+  class Scope {
+  public:
+    // name and arg_name must outlive the timeline, string literals are expected.
+    explicit Scope(const char* name, const char* arg_name = nullptr, int64_t arg = 0)
+      : buffer_(current_), name_(name) {
+      if (buffer_ != nullptr) buffer_->Record('B', name, arg_name, arg);
+    }
+
+    ~Scope() {
+      if (buffer_ != nullptr) buffer_->Record('E', name_, nullptr, 0);
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Buffer* buffer_;
+    const char* name_;
+  };
+
+  Timeline() : start_(Clock::now()) { }
+
+  Timeline(const Timeline&) = delete;
+  Timeline& operator=(const Timeline&) = delete;
+
+  // Buffers live as long as the timeline, each one shows up as its own track.
+  Buffer* NewBuffer(std::string name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back(std::move(name), buffers_.size() + 1);
+    return &buffers_.back();
+  }
+
+  // Makes the calling thread record into buffer until the binding goes out of
+  // scope, a null buffer records nothing.
+  class Binding {
+  public:
+    explicit Binding(Buffer* buffer) : previous_(current_) { current_ = buffer; }
+    ~Binding() { current_ = previous_; }
+
+    Binding(const Binding&) = delete;
+    Binding& operator=(const Binding&) = delete;
+
+  private:
+    Buffer* previous_;
+  };
+
+  // Must not run while any thread is still recording.
+  void Write(std::ostream& os) const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static inline thread_local Buffer* current_ = nullptr;
+
+  Clock::time_point start_;
+  std::mutex mutex_;
+  std::list<Buffer> buffers_;
+};
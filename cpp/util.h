@@ -1,18 +1,59 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <shared_mutex>
 #include <vector>
 
+#include "timeline.h"
+
+
+// Standard allocator that keeps a running total of the bytes it holds, so the
+// containers below can report their exact footprint.
+template<class T>
+class CountingAllocator {
+public:
+  using value_type = T;
+
+  explicit CountingAllocator(std::atomic<size_t>* counter) : counter_(counter) { }
+
+  template<class U>
+  CountingAllocator(const CountingAllocator<U>& other) : counter_(other.counter_) { }
+
+  T* allocate(size_t n) {
+    counter_->fetch_add(n * sizeof(T), std::memory_order_relaxed);
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    counter_->fetch_sub(n * sizeof(T), std::memory_order_relaxed);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template<class U>
+  bool operator==(const CountingAllocator<U>& other) const { return counter_ == other.counter_; }
+  template<class U>
+  bool operator!=(const CountingAllocator<U>& other) const { return counter_ != other.counter_; }
+
+private:
+  template<class U> friend class CountingAllocator;
+
+  std::atomic<size_t>* counter_;
+};
+
 
 template<class T>
 class PartitionedList {
 public:
-  using Partition = std::deque<T>;
+  using Partition = std::deque<T, CountingAllocator<T>>;
 
-  PartitionedList(size_t num_partitions) : partitions_(num_partitions) { }
+  PartitionedList(size_t num_partitions)
+    : bytes_(0), partitions_(num_partitions, Partition(CountingAllocator<T>(&bytes_))) { }
 
   void push_back(size_t part_id, const T& value) {
     partitions_[part_id].push_back(value);
@@ -57,7 +98,7 @@ public:
 
     std::vector<Partition>& partitions_;
     size_t part_id_;
-    typename std::deque<T>::iterator iter_;
+    typename Partition::iterator iter_;
   };
 
   Iterator begin() { return Iterator(partitions_, true); }
@@ -70,83 +111,615 @@ public:
     return total;
   }
 
+  size_t AllocatedBytes() const {
+    return bytes_.load(std::memory_order_relaxed) + partitions_.capacity() * sizeof(Partition);
+  }
+
 private:
+  std::atomic<size_t> bytes_;
   std::vector<Partition> partitions_;
 };
 
 
 class ConcurrentIntegerSet {
 public:
-  ConcurrentIntegerSet() : size_(0), buckets_size_(0), buckets_(nullptr) { Resize(); }
-  ~ConcurrentIntegerSet() { delete[] buckets_; }
+  ConcurrentIntegerSet()
+    : size_(0), buckets_size_(0), bytes_(0), buckets_(CountingAllocator<Bucket>(&bytes_)) { Resize(); }
 
   inline bool InsertIfNotExist(int64_t value) {
     {
       std::shared_lock<std::shared_mutex> lock(mutex_);
-      auto& bucket = buckets_[value & (buckets_size_ - 1)];
-      for (auto& v : bucket) {
-        if (v == value) return false;
-      }
+      if (ContainsUnlocked(value)) return false;
     }
     std::unique_lock<std::shared_mutex> lock(mutex_);
+    return InsertUnlocked(value);
+  }
+
+  inline bool Contains(int64_t value) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return ContainsUnlocked(value);
+  }
+
+  // The unlocked variants are for callers that guarantee no other thread
+  // writes this set at the same time.
+  inline bool ContainsUnlocked(int64_t value) const {
+    for (auto& v : buckets_[value & (buckets_size_ - 1)]) {
+      if (v == value) return true;
+    }
+    return false;
+  }
+
+  inline bool InsertUnlocked(int64_t value) {
     auto& bucket = buckets_[value & (buckets_size_ - 1)];
+    for (auto& v : bucket) {
+      if (v == value) return false;
+    }
     bucket.push_back(value);
     ++size_;
     if (buckets_size_ * 1.5 < size_) Resize();
     return true;
   }
 
+  inline void Prefetch(int64_t value) const {
+    __builtin_prefetch(&buckets_[value & (buckets_size_ - 1)]);
+  }
+
+  void Clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    Buckets(CountingAllocator<Bucket>(&bytes_)).swap(buckets_);
+    size_ = 0;
+    Resize();
+  }
+
+  // Allocates the buckets for num_values values at once, so that inserting up
+  // to that many does not resize the set on the way.
+  void Reserve(size_t num_values) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (buckets_size_ * 1.5 >= num_values) return;
+    size_t new_size = buckets_size_;
+    while (new_size < num_values) {
+      new_size *= 2;
+    }
+    Rehash(new_size);
+  }
+
+  size_t Size() const { return size_; }
+  size_t AllocatedBytes() const { return bytes_.load(std::memory_order_relaxed); }
+
 private:
+  using Bucket = std::vector<int64_t, CountingAllocator<int64_t>>;
+  using Buckets = std::vector<Bucket, CountingAllocator<Bucket>>;
+
   size_t size_;
   size_t buckets_size_;
-  std::vector<int64_t>* buckets_;
-  std::shared_mutex mutex_;
+  std::atomic<size_t> bytes_;
+  Buckets buckets_;
+  mutable std::shared_mutex mutex_;
 
   void Resize() {
     size_t new_size = 16;
     while (new_size < size_ * 3) {
       new_size *= 2;
     }
-    auto new_buckets = new std::vector<int64_t>[new_size];
-    for (size_t i = 0; i < buckets_size_; ++i) {
-      auto& bucket = buckets_[i];
+    Rehash(new_size);
+  }
+
+  void Rehash(size_t new_size) {
+    Timeline::Scope scope("set resize", "buckets", new_size);
+    CountingAllocator<int64_t> allocator(&bytes_);
+    Buckets new_buckets(new_size, Bucket(allocator), CountingAllocator<Bucket>(&bytes_));
+    for (auto& bucket : buckets_) {
       for (auto& value : bucket) {
         new_buckets[value & (new_size - 1)].push_back(value);
       }
     }
-    delete[] buckets_;
-    buckets_ = new_buckets;
+    buckets_.swap(new_buckets);
     buckets_size_ = new_size;
   }
 };
 
 
+// Dense set of the integers in [0, limit) with one bit per value. Pages of
+// bits are allocated when the first value in their range is inserted, so a
+// large limit only costs the ranges that are actually reached. Inserting is a
+// single fetch_or and needs no lock.
+class ConcurrentBitmap {
+public:
+  explicit ConcurrentBitmap(uint64_t limit)
+    : limit_(limit), num_pages_((limit + PAGE_SIZE - 1) / PAGE_SIZE), bytes_(0),
+    pages_(new std::atomic<Word*>[num_pages_]) {
+    for (size_t i = 0; i < num_pages_; ++i) pages_[i].store(nullptr, std::memory_order_relaxed);
+    bytes_ += num_pages_ * sizeof(std::atomic<Word*>);
+  }
+
+  ~ConcurrentBitmap() { Clear(); }
+
+  ConcurrentBitmap(const ConcurrentBitmap&) = delete;
+  ConcurrentBitmap& operator=(const ConcurrentBitmap&) = delete;
+
+  inline bool Covers(int64_t value) const { return static_cast<uint64_t>(value) < limit_; }
+
+  // The value must be covered.
+  inline bool Contains(int64_t value) const {
+    const Word* page = pages_[value / PAGE_SIZE].load(std::memory_order_acquire);
+    return page != nullptr && (page[value % PAGE_SIZE / 64].load(std::memory_order_relaxed) & Bit(value));
+  }
+
+  // The value must be covered.
+  inline bool InsertIfNotExist(int64_t value) {
+    Word* page = pages_[value / PAGE_SIZE].load(std::memory_order_acquire);
+    if (page == nullptr) page = NewPage(value / PAGE_SIZE);
+    return !(page[value % PAGE_SIZE / 64].fetch_or(Bit(value), std::memory_order_relaxed) & Bit(value));
+  }
+
+  // Must not run while any thread inserts.
+  void Clear() {
+    for (size_t i = 0; i < num_pages_; ++i) {
+      delete[] pages_[i].exchange(nullptr, std::memory_order_relaxed);
+    }
+    bytes_ = num_pages_ * sizeof(std::atomic<Word*>);
+  }
+
+  size_t AllocatedBytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+  using Word = std::atomic<uint64_t>;
+
+  // Bits per page, a page takes 8KB.
+  static constexpr uint64_t PAGE_SIZE = 64 * 1024;
+
+  const uint64_t limit_;
+  const size_t num_pages_;
+  std::atomic<size_t> bytes_;
+  std::unique_ptr<std::atomic<Word*>[]> pages_;
+
+  static inline uint64_t Bit(int64_t value) { return uint64_t(1) << (value % 64); }
+
+  // Threads that race for a page all end up with the one that got published.
+  Word* NewPage(size_t index) {
+    Word* page = new Word[PAGE_SIZE / 64];
+    for (size_t i = 0; i < PAGE_SIZE / 64; ++i) page[i].store(0, std::memory_order_relaxed);
+    Word* expected = nullptr;
+    if (!pages_[index].compare_exchange_strong(expected, page, std::memory_order_acq_rel)) {
+      delete[] page;
+      return expected;
+    }
+    bytes_ += PAGE_SIZE / 8;
+    return page;
+  }
+};
+
+
 template<size_t NumBuckets>
 class ConcurrentNumericSet {
 public:
-  ConcurrentNumericSet(double precision) : precision_(precision) { }
+  // Integers, doubles below precision * INT64_MAX and bigger doubles are kept in
+  // separate groups of NumBuckets integer sets each.
+  static constexpr size_t NUM_GROUPS = 3;
+  static constexpr size_t NUM_SETS = NumBuckets * NUM_GROUPS;
+
+  // A value as stored: the integer set that holds it and its integer form.
+  struct Key {
+    size_t set_id;
+    int64_t value;
+  };
 
-  inline bool InsertIfNotExist(int64_t value) {
-    return ints_[value % NumBuckets].InsertIfNotExist(value);
+  // Integers in [0, bitmap_limit) are kept in a bitmap instead of the sets.
+  ConcurrentNumericSet(double precision, uint64_t bitmap_limit)
+    : precision_(precision), bitmap_(bitmap_limit) { }
+
+  inline Key MakeKey(int64_t value) const {
+    return { static_cast<size_t>(value % NumBuckets), value };
   }
 
-  inline bool InsertIfNotExist(double value) {
+  inline Key MakeKey(double value) const {
     if (precision_ * INT64_MAX > value) {
       int64_t value_as_int = static_cast<int64_t>(value / precision_);
-      return double_as_ints_[value_as_int % NumBuckets].InsertIfNotExist(value_as_int);
+      return { NumBuckets + value_as_int % NumBuckets, value_as_int };
     } else {
       double offset_value = value - precision_ * INT64_MAX;
       int64_t value_as_int = static_cast<int64_t>(offset_value / precision_);
-      return big_doubles_[value_as_int % NumBuckets].InsertIfNotExist(value_as_int);
+      return { 2 * NumBuckets + value_as_int % NumBuckets, value_as_int };
     }
   }
 
+  // Keys are equal exactly when their groups and integer forms are.
+  static size_t Group(const Key& key) { return key.set_id / NumBuckets; }
+
+  inline bool InsertIfNotExist(int64_t value) {
+    return InsertIfNotExist(MakeKey(value));
+  }
+
+  inline bool InsertIfNotExist(double value) {
+    return InsertIfNotExist(MakeKey(value));
+  }
+
+  inline bool InsertIfNotExist(const Key& key) {
+    if (InBitmap(key)) return bitmap_.InsertIfNotExist(key.value);
+    return sets_[key.set_id].InsertIfNotExist(key.value);
+  }
+
+  inline bool Contains(const Key& key) const {
+    if (InBitmap(key)) return bitmap_.Contains(key.value);
+    return sets_[key.set_id].Contains(key.value);
+  }
+
+  // Keys with different set ids never touch the same integer set, so threads
+  // may use the unlocked variants on disjoint set ids.
+  inline bool ContainsUnlocked(const Key& key) const {
+    if (InBitmap(key)) return bitmap_.Contains(key.value);
+    return sets_[key.set_id].ContainsUnlocked(key.value);
+  }
+
+  inline bool InsertUnlocked(const Key& key) {
+    if (InBitmap(key)) return bitmap_.InsertIfNotExist(key.value);
+    return sets_[key.set_id].InsertUnlocked(key.value);
+  }
+
+  inline void Prefetch(const Key& key) const {
+    if (!InBitmap(key)) sets_[key.set_id].Prefetch(key.value);
+  }
+
+  void Clear() {
+    bitmap_.Clear();
+    ClearSets();
+  }
+
+  // Frees the hash sets but keeps the bitmap, which is small.
+  void ClearSets() {
+    for (auto& set : sets_) set.Clear();
+  }
+
+  // Makes room in every hash set for growth times the values it holds, values
+  // are assumed to keep spreading over the sets as they did so far.
+  void Reserve(double growth) {
+    for (auto& set : sets_) set.Reserve(static_cast<size_t>(set.Size() * growth));
+  }
+
+  size_t AllocatedBytes() const {
+    size_t total = bitmap_.AllocatedBytes();
+    for (auto& set : sets_) total += set.AllocatedBytes();
+    return total;
+  }
+
 private:
   const double precision_;
 
-  ConcurrentIntegerSet ints_[NumBuckets];
-  ConcurrentIntegerSet double_as_ints_[NumBuckets];
-  ConcurrentIntegerSet big_doubles_[NumBuckets];
+  ConcurrentBitmap bitmap_;
+  ConcurrentIntegerSet sets_[NUM_SETS];
+
+  inline bool InBitmap(const Key& key) const {
+    return key.set_id < NumBuckets && bitmap_.Covers(key.value);
+  }
+};
+
+
+// Single threaded open addressing set that collects values with a payload
+// until they are merged into a shared set in bulk. Values are identified by a
+// partition id and an integer, and are handed out grouped by partition.
+template<class Payload, size_t NumPartitions>
+class StagingBuffer {
+public:
+  struct Entry {
+    int64_t value;
+    size_t partition;
+    Payload payload;
+  };
+
+  explicit StagingBuffer(std::atomic<size_t>* counter)
+    : entries_(CountingAllocator<Entry>(counter)), slots_(CountingAllocator<uint32_t>(counter)),
+    partitioned_(CountingAllocator<Entry>(counter)) { }
+
+  bool empty() const { return entries_.empty(); }
+
+  // Returns false when the value has already been staged since the last Flush().
+  bool Insert(size_t partition, int64_t value, const Payload& payload) {
+    if ((entries_.size() + 1) * 2 > slots_.size()) Grow();
+    size_t mask = slots_.size() - 1;
+    for (size_t i = Hash(partition, value) & mask; ; i = (i + 1) & mask) {
+      uint32_t slot = slots_[i];
+      if (slot == 0) {
+        entries_.push_back({ value, partition, payload });
+        slots_[i] = static_cast<uint32_t>(entries_.size());
+        return true;
+      }
+      const Entry& entry = entries_[slot - 1];
+      if (entry.value == value && entry.partition == partition) return false;
+    }
+  }
+
+  // Radix partitions the staged entries by partition id and empties the set,
+  // the partitioned entries stay readable until the next Flush(). Returns the
+  // number of partitioned entries.
+  size_t Flush() {
+    size_t offsets[NumPartitions + 1] = {};
+    for (const Entry& entry : entries_) ++offsets[entry.partition + 1];
+    for (size_t p = 0; p < NumPartitions; ++p) offsets[p + 1] += offsets[p];
+    std::copy(offsets, offsets + NumPartitions + 1, partition_begin_);
+    partitioned_.resize(entries_.size());
+    for (const Entry& entry : entries_) partitioned_[offsets[entry.partition]++] = entry;
+    entries_.clear();
+    std::fill(slots_.begin(), slots_.end(), 0);
+    return partitioned_.size();
+  }
+
+  // Frees all storage, staged and partitioned entries are dropped.
+  void Release() {
+    decltype(entries_)(entries_.get_allocator()).swap(entries_);
+    decltype(slots_)(slots_.get_allocator()).swap(slots_);
+    decltype(partitioned_)(partitioned_.get_allocator()).swap(partitioned_);
+    std::fill(partition_begin_, partition_begin_ + NumPartitions + 1, 0);
+  }
+
+  const Entry* PartitionBegin(size_t partition) const {
+    return partitioned_.data() + partition_begin_[partition];
+  }
+
+  const Entry* PartitionEnd(size_t partition) const {
+    return partitioned_.data() + partition_begin_[partition + 1];
+  }
+
+private:
+  std::vector<Entry, CountingAllocator<Entry>> entries_;
+  std::vector<uint32_t, CountingAllocator<uint32_t>> slots_;
+  std::vector<Entry, CountingAllocator<Entry>> partitioned_;
+  size_t partition_begin_[NumPartitions + 1] = {};
+
+  static size_t Hash(size_t partition, int64_t value) {
+    uint64_t h = static_cast<uint64_t>(value) * 0x9E3779B97F4A7C15ull + partition;
+    return static_cast<size_t>(h ^ (h >> 29));
+  }
+
+  void Grow() {
+    size_t new_size = std::max<size_t>(slots_.size() * 2, 1024);
+    slots_.assign(new_size, 0);
+    size_t mask = new_size - 1;
+    for (size_t e = 0; e < entries_.size(); ++e) {
+      size_t i = Hash(entries_[e].partition, entries_[e].value) & mask;
+      while (slots_[i] != 0) i = (i + 1) & mask;
+      slots_[i] = static_cast<uint32_t>(e + 1);
+    }
+  }
+};
+
+
+// Stable LSD radix sort of entries by their int64_t value, 16 bits per pass.
+// Passes over digits that every entry shares are skipped, so keys spanning a
+// small range only cost a couple of sequential passes. Few entries are merge
+// sorted instead, as clearing the digit counts would dominate.
+template<class Entry, class Allocator>
+void RadixSortByValue(std::vector<Entry, Allocator>& entries, std::vector<Entry, Allocator>& scratch) {
+  constexpr int DIGIT_BITS = 16;
+  constexpr size_t NUM_DIGITS = size_t(1) << DIGIT_BITS;
+  auto ordered = [](int64_t value) { return static_cast<uint64_t>(value) ^ (uint64_t(1) << 63); };
+  if (entries.size() < NUM_DIGITS / 16) {
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const Entry& a, const Entry& b) { return a.value < b.value; });
+    return;
+  }
+  uint64_t all_or = 0, all_and = ~uint64_t(0);
+  for (const Entry& entry : entries) {
+    all_or |= ordered(entry.value);
+    all_and &= ordered(entry.value);
+  }
+  std::vector<size_t> offsets(NUM_DIGITS);
+  scratch.resize(entries.size());
+  for (int shift = 0; shift < 64; shift += DIGIT_BITS) {
+    if ((((all_or ^ all_and) >> shift) & (NUM_DIGITS - 1)) == 0) continue;
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (const Entry& entry : entries) ++offsets[(ordered(entry.value) >> shift) & (NUM_DIGITS - 1)];
+    size_t sum = 0;
+    for (size_t& offset : offsets) {
+      size_t count = offset;
+      offset = sum;
+      sum += count;
+    }
+    for (const Entry& entry : entries) {
+      scratch[offsets[(ordered(entry.value) >> shift) & (NUM_DIGITS - 1)]++] = entry;
+    }
+    entries.swap(scratch);
+  }
+  scratch.clear();
+}
+
+
+// Single threaded buffer that collects values with a payload in groups, and
+// sorts every group by value in bulk. Values appended after Sort() are only
+// sorted by the next Sort(), so the sorted groups can be read meanwhile.
+// Groups that grow large are compacted in between, see Append().
+template<class Payload, size_t NumGroups>
+class SortingBuffer {
+public:
+  struct Entry {
+    int64_t value;
+    Payload payload;
+  };
+
+  using Entries = std::vector<Entry, CountingAllocator<Entry>>;
+
+  explicit SortingBuffer(std::atomic<size_t>* counter) : scratch_(CountingAllocator<Entry>(counter)) {
+    std::fill(compact_at_, compact_at_ + NumGroups, MIN_COMPACT_SIZE);
+    for (size_t g = 0; g < NumGroups; ++g) {
+      appended_.emplace_back(CountingAllocator<Entry>(counter));
+      sorted_.emplace_back(CountingAllocator<Entry>(counter));
+    }
+  }
+
+  // Returns true when the appended entries of the group should be compacted.
+  bool Append(size_t group, int64_t value, const Payload& payload) {
+    appended_[group].push_back({ value, payload });
+    return appended_[group].size() >= compact_at_[group];
+  }
+
+  // Sorts the appended entries of a group and keeps only the first entry of
+  // each value, unless drop(value) is true. drop is called in increasing order
+  // of values, so it can walk another sorted array alongside.
+  template<class Drop>
+  void Compact(size_t group, Drop&& drop) {
+    Entries& entries = appended_[group];
+    RadixSortByValue(entries, scratch_);
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (i > 0 && entries[i].value == entries[i - 1].value) continue;
+      if (!drop(entries[i].value)) entries[kept++] = entries[i];
+    }
+    entries.resize(kept);
+    compact_at_[group] = std::max(MIN_COMPACT_SIZE, 2 * kept);
+  }
+
+  // Replaces the sorted groups with the entries appended since the last call,
+  // equal values keep their order of appending. Returns the number of entries.
+  size_t Sort() {
+    size_t total = 0;
+    for (size_t g = 0; g < NumGroups; ++g) {
+      sorted_[g].clear();
+      sorted_[g].swap(appended_[g]);
+      RadixSortByValue(sorted_[g], scratch_);
+      total += sorted_[g].size();
+      compact_at_[g] = MIN_COMPACT_SIZE;
+    }
+    return total;
+  }
+
+  const Entries& Sorted(size_t group) const { return sorted_[group]; }
+
+  // Frees all storage, appended and sorted entries are dropped.
+  void Release() {
+    for (size_t g = 0; g < NumGroups; ++g) {
+      Entries(appended_[g].get_allocator()).swap(appended_[g]);
+      Entries(sorted_[g].get_allocator()).swap(sorted_[g]);
+    }
+    Entries(scratch_.get_allocator()).swap(scratch_);
+  }
+
+private:
+  static constexpr size_t MIN_COMPACT_SIZE = 8 * 1024;
+
+  std::vector<Entries> appended_;
+  std::vector<Entries> sorted_;
+  Entries scratch_;
+  size_t compact_at_[NumGroups];
+};
+
+
+// Single threaded buffer that keeps the width entries with the lowest scores
+// offered to it, at most one per key.
+template<class Payload>
+class BeamBuffer {
+public:
+  using Key = std::pair<size_t, int64_t>;
+
+  struct Entry {
+    double score;
+    Key key;
+    Payload payload;
+  };
+
+  explicit BeamBuffer(std::atomic<size_t>* counter)
+    : entries_(CountingAllocator<Entry>(counter)), keys_(std::less<Key>(), CountingAllocator<Key>(counter)) { }
+
+  void SetWidth(size_t width) { width_ = width; }
+  size_t size() const { return entries_.size(); }
+
+  // Whether an entry with score would currently be kept.
+  bool Admits(double score) const {
+    return entries_.size() < width_ || (width_ > 0 && score < entries_.front().score);
+  }
+
+  void Offer(double score, const Key& key, const Payload& payload) {
+    if (!Admits(score) || !keys_.insert(key).second) return;
+    if (entries_.size() == width_) {
+      std::pop_heap(entries_.begin(), entries_.end(), LowerScore);
+      keys_.erase(entries_.back().key);
+      entries_.pop_back();
+    }
+    entries_.push_back({ score, key, payload });
+    std::push_heap(entries_.begin(), entries_.end(), LowerScore);
+  }
+
+  // Calls f with the entries from the lowest score up and empties the buffer.
+  template<class F>
+  void Drain(F&& f) {
+    std::sort_heap(entries_.begin(), entries_.end(), LowerScore);
+    for (const Entry& entry : entries_) f(entry);
+    entries_.clear();
+    keys_.clear();
+  }
+
+private:
+  // Keeps the highest score on top of the heap, the first to be evicted.
+  static bool LowerScore(const Entry& a, const Entry& b) { return a.score < b.score; }
+
+  size_t width_ = 0;
+  std::vector<Entry, CountingAllocator<Entry>> entries_;
+  std::set<Key, std::less<Key>, CountingAllocator<Key>> keys_;
+};
+
+
+// Remembers a payload per key of a ConcurrentNumericSet in a fixed number of
+// slots. Every key maps to one slot and a store replaces whatever the slot
+// held, so the table forgets old keys instead of growing.
+template<class Payload>
+class TranspositionTable {
+public:
+  TranspositionTable(size_t num_slots, std::atomic<size_t>* counter)
+    : slots_(num_slots, Slot(), CountingAllocator<Slot>(counter)) { }
+
+  bool Find(size_t set_id, int64_t value, Payload* payload) const {
+    const Slot& slot = slots_[Index(set_id, value)];
+    if (slot.set_id != set_id || slot.value != value) return false;
+    *payload = slot.payload;
+    return true;
+  }
+
+  void Store(size_t set_id, int64_t value, const Payload& payload) {
+    slots_[Index(set_id, value)] = { value, set_id, payload };
+  }
+
+private:
+  struct Slot {
+    int64_t value = 0;
+    size_t set_id = SIZE_MAX;
+    Payload payload = Payload();
+  };
+
+  std::vector<Slot, CountingAllocator<Slot>> slots_;
+
+  size_t Index(size_t set_id, int64_t value) const {
+    uint64_t hash = (static_cast<uint64_t>(value) ^ (static_cast<uint64_t>(set_id) << 48)) * 0x9E3779B97F4A7C15ull;
+    return (hash >> 20) % slots_.size();
+  }
+};
+
+
+// The keys of a ConcurrentNumericSet as one sorted array per group, for
+// callers that deduplicate in bulk with merge joins instead of hash probes.
+template<size_t NumGroups>
+class SortedNumericSet {
+public:
+  using Values = std::vector<int64_t, CountingAllocator<int64_t>>;
+
+  SortedNumericSet() : bytes_(0) {
+    for (size_t g = 0; g < NumGroups; ++g) groups_.emplace_back(CountingAllocator<int64_t>(&bytes_));
+  }
+
+  const Values& Group(size_t group) const { return groups_[group]; }
+
+  // An empty array that may replace a group, see Replace().
+  Values NewValues() { return Values(CountingAllocator<int64_t>(&bytes_)); }
+
+  // values must be sorted and hold every value of the group it replaces.
+  void Replace(size_t group, Values&& values) { groups_[group] = std::move(values); }
+
+  void Clear() {
+    for (auto& values : groups_) Values(CountingAllocator<int64_t>(&bytes_)).swap(values);
+  }
+
+  size_t AllocatedBytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<size_t> bytes_;
+  std::vector<Values> groups_;
 };
 
 
@@ -165,11 +738,14 @@ private:
     return chunks_.back();
   }
 
-  std::list<Chunk> chunks_;
+  std::atomic<size_t> bytes_;
+  std::list<Chunk, CountingAllocator<Chunk>> chunks_;
   size_t uncommitted_size_;
 
 public:
-  ObjectPool() : uncommitted_size_(0) { chunks_.emplace_back(); }
+  ObjectPool() : bytes_(0), chunks_(CountingAllocator<Chunk>(&bytes_)), uncommitted_size_(0) {
+    chunks_.emplace_back();
+  }
 
   ObjectPool(const ObjectPool&) = delete;
   ObjectPool& operator=(const ObjectPool&) = delete;
@@ -186,4 +762,24 @@ public:
     chunks_.back().next += uncommitted_size_;
     uncommitted_size_ = 0;
   }
+
+  struct Checkpoint {
+    size_t num_chunks;
+    size_t next;
+  };
+
+  Checkpoint GetCheckpoint() const {
+    return { chunks_.size(), chunks_.back().next };
+  }
+
+  size_t AllocatedBytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+  // Drops every object committed after the checkpoint without destroying it.
+  void Rollback(const Checkpoint& checkpoint) {
+    while (chunks_.size() > checkpoint.num_chunks) chunks_.pop_back();
+    chunks_.back().next = checkpoint.next;
+    uncommitted_size_ = 0;
+  }
+
+  void Clear() { Rollback({ 1, 0 }); }
 };
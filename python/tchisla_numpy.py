@@ -0,0 +1,298 @@
+from math import factorial, pow
+
+import numpy as np
+
+from tchisla import (AddExpr, DivExpr, Expr, FactorialExpr, LiteralExpr, MulExpr, PowExpr,
+                     SqrtExpr, SubExpr, TchislaSolver)
+
+LITERAL, ADD, SUB, MUL, DIV, POW, FACTORIAL, SQRT = range(8)
+
+BINARY_EXPRS = {ADD: AddExpr, SUB: SubExpr, MUL: MulExpr, DIV: DivExpr, POW: PowExpr}
+
+POWER = np.frompyfunc(pow, 2, 1)
+
+FACTORIALS = np.array([factorial(n) for n in range(TchislaSolver.factorial_limit + 1)],
+                      dtype=np.float64)
+
+# A key orders candidates the way TchislaSolver makes them one by one: by the
+# operand pair, then by the operator, then by the chain of factorials (digit 1)
+# and square roots (digit 2) applied to the result, one base 3 digit per step
+# from the most significant. Such a chain only continues through small or
+# perfect square integers and ends within a few steps.
+MAX_UNARY_DEPTH = 16
+UNARY_DIGIT = [3 ** (MAX_UNARY_DEPTH - 1 - depth) for depth in range(MAX_UNARY_DEPTH)]
+PAIR_KEY = 3 ** MAX_UNARY_DEPTH
+
+
+class Candidates:
+  """Values with the operator and the ids of the operands that made them, the
+  key of each and the number of unary operators that ends its chain."""
+
+  def __init__(self, values, ops, lefts, rights, keys, depths):
+    self.values = values
+    self.ops = ops
+    self.lefts = lefts
+    self.rights = rights
+    self.keys = keys
+    self.depths = depths
+
+  @staticmethod
+  def empty():
+    return Candidates(np.empty(0, np.float64), np.empty(0, np.int8), np.empty(0, np.int64),
+                      np.empty(0, np.int64), np.empty(0, np.int64), np.empty(0, np.int8))
+
+  @staticmethod
+  def concatenate(parts):
+    if not parts:
+      return Candidates.empty()
+    return Candidates(np.concatenate([c.values for c in parts]),
+                      np.concatenate([c.ops for c in parts]),
+                      np.concatenate([c.lefts for c in parts]),
+                      np.concatenate([c.rights for c in parts]),
+                      np.concatenate([c.keys for c in parts]),
+                      np.concatenate([c.depths for c in parts]))
+
+  def __len__(self):
+    return len(self.values)
+
+  def assign(self, index, other):
+    self.values[index] = other.values
+    self.ops[index] = other.ops
+    self.lefts[index] = other.lefts
+    self.rights[index] = other.rights
+    self.keys[index] = other.keys
+    self.depths[index] = other.depths
+
+  def insert(self, index, other):
+    return Candidates(np.insert(self.values, index, other.values),
+                      np.insert(self.ops, index, other.ops),
+                      np.insert(self.lefts, index, other.lefts),
+                      np.insert(self.rights, index, other.rights),
+                      np.insert(self.keys, index, other.keys),
+                      np.insert(self.depths, index, other.depths))
+
+  def take(self, index):
+    return Candidates(self.values[index], self.ops[index], self.lefts[index], self.rights[index],
+                      self.keys[index], self.depths[index])
+
+
+class NumpyTchislaSolver(TchislaSolver):
+  """Same search as TchislaSolver, but generations are arrays of values and
+  provenance. Each operator runs over the outer product of two generations in
+  chunks, and Expr objects are only built for the result. Candidates are kept
+  and found in the order TchislaSolver makes them, so both print the same
+  expressions."""
+
+  # Number of operand pairs crossed at once.
+  chunk_size = 1 << 18
+
+  def __init__(self, target: int, seed: int):
+    TchislaSolver.__init__(self, target, seed)
+    # Every value found so far, in the order found, its id is its index.
+    self.found = Candidates.empty()
+    self.found_parts = []
+    self.num_found = 0
+    # Sorted values of the finished generations and of the current one.
+    self.seen = np.empty(0, np.float64)
+    self.current_seen = np.empty(0, np.float64)
+    self.current_begin = 0
+
+  def cross_candidates(self, c1, c2):
+    ids1, ids2 = np.arange(*c1), np.arange(*c2)
+    values1, values2 = self.found.values[ids1], self.found.values[ids2]
+    rows = max(1, self.chunk_size // len(ids2))
+    for row in range(0, len(ids1), rows):
+      a, b = np.broadcast_arrays(values1[row:row + rows, None], values2[None, :])
+      ia, ib = np.broadcast_arrays(ids1[row:row + rows, None], ids2[None, :])
+      a, b, ia, ib = a.ravel(), b.ravel(), ia.ravel(), ib.ravel()
+      larger = a > b
+      # One column per operator, in the order TchislaSolver.cross_candidates()
+      # tries them on a pair.
+      columns = [(ADD, a + b, ia, ib),
+                 (SUB, np.abs(a - b), np.where(larger, ia, ib), np.where(larger, ib, ia)),
+                 (MUL, a * b, ia, ib),
+                 (DIV, a / b, ia, ib),
+                 (DIV, b / a, ib, ia),
+                 (POW, power_if_int(a, b), ia, ib),
+                 (POW, power_if_int(b, a), ib, ia)]
+      size = len(a) * len(columns)
+      self.add_candidates(Candidates(
+          np.stack([column[1] for column in columns], axis=1).ravel(),
+          np.tile(np.array([column[0] for column in columns], np.int8), len(a)),
+          np.stack([column[2] for column in columns], axis=1).ravel(),
+          np.stack([column[3] for column in columns], axis=1).ravel(),
+          np.arange(size, dtype=np.int64) * PAIR_KEY,
+          np.zeros(size, np.int8)))
+
+  def add_candidates(self, candidates):
+    """Adds the candidates, which are in key order, and the factorials and
+    square roots of the new ones as TchislaSolver.add_candidate() would one by
+    one: the first expression of a new value is kept and expanded right after
+    itself. Which values are new does not depend on the order, only which
+    expression of each comes first. So the first candidates are expanded, and
+    a factorial or square root that comes before the expression kept for its
+    value replaces it and is expanded in turn, which ends as keys only drop."""
+    candidates.values = snap(candidates.values)
+    hits = candidates.take(np.flatnonzero(candidates.values == self.target)[:1])
+    if len(hits) > 0:
+      # Nothing after the first hit is made.
+      candidates = candidates.take(slice(0, np.searchsorted(candidates.keys, hits.keys[0])))
+    new = changed = self.first_new(candidates)
+    while len(changed) > 0:
+      unary = self.expand(changed)
+      hits = Candidates.concatenate([hits, unary.take(np.flatnonzero(unary.values == self.target))])
+      new, changed = keep_first(new, self.first_new(unary))
+    self.current_seen = merge(self.current_seen, new.values)
+
+    # The ids of the new candidates follow their keys, factorials and square
+    # roots name their operand by its key until then.
+    new = new.take(np.argsort(new.keys))
+    begin = self.num_found
+    self.num_found += len(new)
+    self.resolve_operands(new, begin)
+    self.found_parts.append(new)
+    if len(hits) > 0:
+      hit = hits.take([np.argmin(hits.keys)])
+      self.resolve_operands(hit, begin, new.keys)
+      self.result = self.build(int(hit.ops[0]), int(hit.lefts[0]), int(hit.rights[0]))
+      raise TchislaSolver.Found()
+
+  def first_new(self, candidates):
+    """The first of the candidates, which are in key order, for every value
+    within the limits that no earlier one has, sorted by value."""
+    values = candidates.values
+    index = np.flatnonzero(within_limits(values) & (values != self.target))
+    values, first = np.unique(values[index], return_index=True)
+    new = ~(contains(self.seen, values) | contains(self.current_seen, values))
+    return candidates.take(index[first[new]])
+
+  @staticmethod
+  def expand(new):
+    """The factorials and square roots of the new candidates, in key order."""
+    ints = is_int(new.values)
+    factorials = np.flatnonzero(ints & (new.values <= TchislaSolver.factorial_limit))
+    roots = np.flatnonzero(ints & (new.values > 0))
+    assert (new.depths < MAX_UNARY_DEPTH).all()
+    digits = np.array(UNARY_DIGIT, np.int64)[new.depths]
+    expanded = Candidates.concatenate([
+        Candidates(FACTORIALS[new.values[factorials].astype(np.int64)],
+                   np.full(len(factorials), FACTORIAL, np.int8), new.keys[factorials],
+                   np.full(len(factorials), -1, np.int64),
+                   new.keys[factorials] + digits[factorials], new.depths[factorials] + 1),
+        Candidates(power(new.values[roots], 0.5),
+                   np.full(len(roots), SQRT, np.int8), new.keys[roots],
+                   np.full(len(roots), -1, np.int64),
+                   new.keys[roots] + 2 * digits[roots], new.depths[roots] + 1)])
+    return expanded.take(np.argsort(expanded.keys, kind='stable'))
+
+  @staticmethod
+  def resolve_operands(candidates, begin, keys=None):
+    """Replaces the operand keys of factorials and square roots by the ids the
+    new candidates with those keys get from begin on."""
+    if keys is None:
+      keys = candidates.keys
+    unary = np.flatnonzero((candidates.ops == FACTORIAL) | (candidates.ops == SQRT))
+    candidates.lefts[unary] = begin + np.searchsorted(keys, candidates.lefts[unary])
+
+  def flush(self):
+    if self.found_parts:
+      self.found = Candidates.concatenate([self.found] + self.found_parts)
+      self.found_parts = []
+
+  def next_generation(self, trace):
+    self.flush()
+    begin, end = self.current_begin, self.num_found
+    if trace:
+      values = self.found.values[begin:end]
+      print('Seed: {}, G{}: size={} min={} max={}'.format(self.seed,
+                                                          len(self.generations) + 1,
+                                                          end - begin,
+                                                          as_number(values.min()) if end > begin else None,
+                                                          as_number(values.max()) if end > begin else None))
+    self.generations.append((begin, end))
+    self.seen = merge(self.seen, self.current_seen)
+    self.current_seen = np.empty(0, np.float64)
+    self.current_begin = end
+
+  def add_literal(self, repeats: int):
+    literal = int(str(self.seed) * repeats)
+    self.add_candidates(Candidates(np.array([literal], np.float64), np.array([LITERAL], np.int8),
+                                   np.array([repeats], np.int64), np.array([-1], np.int64),
+                                   np.zeros(1, np.int64), np.zeros(1, np.int8)))
+
+  def build(self, op, left, right):
+    if op == LITERAL:
+      return LiteralExpr(int(str(self.seed) * left))
+    self.flush()
+    child = self.build_id(left)
+    if op == FACTORIAL:
+      return FactorialExpr(child)
+    if op == SQRT:
+      return SqrtExpr(child)
+    return BINARY_EXPRS[op](child, self.build_id(right))
+
+  def build_id(self, id):
+    return self.build(int(self.found.ops[id]), int(self.found.lefts[id]), int(self.found.rights[id]))
+
+
+def keep_first(new, unary):
+  """Merges unary into new, both sorted by value, keeping the lower key of a
+  value both hold. Returns the merged candidates and the ones unary added or
+  replaced."""
+  pos = np.searchsorted(new.values, unary.values)
+  present = np.zeros(len(unary), bool)
+  earlier = np.zeros(len(unary), bool)
+  if len(new) > 0:
+    clipped = np.minimum(pos, len(new) - 1)
+    present = new.values[clipped] == unary.values
+    earlier = present & (unary.keys < new.keys[clipped])
+  replaced = unary.take(np.flatnonzero(earlier))
+  new.assign(pos[earlier], replaced)
+  added = unary.take(np.flatnonzero(~present))
+  return new.insert(pos[~present], added), Candidates.concatenate([replaced, added])
+
+
+def snap(values):
+  """Rounds the values that Expr would store as integers."""
+  rounded = np.rint(values)
+  return np.where(np.abs(values - rounded) < Expr.threshold, rounded, values)
+
+
+def power(bases, exponents):
+  """Python's float pow, the vectorized np.power may round differently."""
+  return POWER(bases, exponents).astype(np.float64)
+
+
+def power_if_int(bases, exponents):
+  """The powers TchislaSolver.add_power() takes, NaN where the exponent is not
+  an integer within the power limit."""
+  values = np.full(len(bases), np.nan)
+  mask = is_int(exponents) & (exponents <= TchislaSolver.power_limit)
+  values[mask] = power(bases[mask], exponents[mask])
+  return values
+
+
+def within_limits(values):
+  return (values >= TchislaSolver.value_min_limit) & (values <= TchislaSolver.value_max_limit)
+
+
+def contains(sorted_values, values):
+  """np.isin for values already sorted, without sorting them again."""
+  if len(sorted_values) == 0:
+    return np.zeros(len(values), bool)
+  index = np.minimum(np.searchsorted(sorted_values, values), len(sorted_values) - 1)
+  return sorted_values[index] == values
+
+
+def merge(sorted_values, new_values):
+  """Inserts sorted values that sorted_values does not hold."""
+  return np.insert(sorted_values, np.searchsorted(sorted_values, new_values), new_values)
+
+
+def is_int(values):
+  return values == np.rint(values)
+
+
+def as_number(value):
+  value = float(value)
+  return int(value) if value.is_integer() else value
@@ -1,6 +1,12 @@
+import sys
+
 from tchisla import TchislaSolver
 from math import factorial
 
+# With --numpy the same cases run on the NumPy engine.
+if '--numpy' in sys.argv[1:]:
+  from tchisla_numpy import NumpyTchislaSolver as TchislaSolver
+
 target = 2016
 optimal_solutions = [None, 9, 6, 4, 4, 6, 4, 6, 5, 4]
 